@@ -0,0 +1,335 @@
+#include "json-rpc/proto.hpp"
+#include "json-rpc/errors.hpp"
+#include "json-rpc/numarray.hpp"
+#include "json-rpc/client/encoder.hpp"
+#include "jconer/json.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <functional>
+
+using namespace JCONER;
+
+/**
+ * Allocation accounting. Every operator new in this binary goes through here
+ * so a benchmark can report how many allocations and bytes one op costs.
+ **/
+static size_t g_alloc_count = 0;
+static size_t g_alloc_bytes = 0;
+
+void* operator new(size_t size) {
+  g_alloc_count ++;
+  g_alloc_bytes += size;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// Same shape as the classes stubgen emits for specs/spec.json
+class Point {
+  public:
+    int x;
+    std::string y;
+
+    template<class Serializer>
+      void seralize(Serializer& serializer) {
+        serializer & x;
+        serializer & y;
+      }
+};
+
+class Rectangle {
+  public:
+    Point from;
+    Point to;
+
+    template<class Serializer>
+      void seralize(Serializer& serializer) {
+        serializer & from;
+        serializer & to;
+      }
+};
+
+// Same shape as the vectors stubgen emits for classes listed in "columnar"
+class PointVector : public std::vector<Point> {
+  public:
+    using std::vector<Point>::vector;
+
+    PointVector() {}
+    PointVector(const std::vector<Point>& v) : std::vector<Point>(v) {}
+
+    static const std::vector<std::string>& column_names() {
+      static const std::vector<std::string> names = {"x", "y"};
+      return names;
+    }
+
+    void seralize(OutSerializer& serializer) {
+      std::vector<std::string> names = column_names();
+      serializer & names;
+      std::vector<int> x;
+      std::vector<std::string> y;
+      x.reserve(size());
+      y.reserve(size());
+      for(size_t i = 0; i < size(); i ++) {
+        x.push_back((*this)[i].x);
+        y.push_back((*this)[i].y);
+      }
+      serializer & x;
+      serializer & y;
+    }
+
+    void seralize(InSerializer& serializer) {
+      std::vector<std::string> names;
+      std::vector<int> x;
+      std::vector<std::string> y;
+      serializer & names;
+      serializer & x;
+      serializer & y;
+      if (names != column_names() || x.size() != y.size()) {
+        throw SerializeFailException();
+      }
+      resize(x.size());
+      for(size_t i = 0; i < size(); i ++) {
+        (*this)[i].x = x[i];
+        (*this)[i].y = std::move(y[i]);
+      }
+    }
+};
+
+class RectangleVector : public std::vector<Rectangle> {
+  public:
+    using std::vector<Rectangle>::vector;
+
+    RectangleVector() {}
+    RectangleVector(const std::vector<Rectangle>& v) : std::vector<Rectangle>(v) {}
+
+    static const std::vector<std::string>& column_names() {
+      static const std::vector<std::string> names = {"from", "to"};
+      return names;
+    }
+
+    void seralize(OutSerializer& serializer) {
+      std::vector<std::string> names = column_names();
+      serializer & names;
+      PointVector from;
+      PointVector to;
+      from.reserve(size());
+      to.reserve(size());
+      for(size_t i = 0; i < size(); i ++) {
+        from.push_back((*this)[i].from);
+        to.push_back((*this)[i].to);
+      }
+      serializer & from;
+      serializer & to;
+    }
+
+    void seralize(InSerializer& serializer) {
+      std::vector<std::string> names;
+      PointVector from;
+      PointVector to;
+      serializer & names;
+      serializer & from;
+      serializer & to;
+      if (names != column_names() || from.size() != to.size()) {
+        throw SerializeFailException();
+      }
+      resize(from.size());
+      for(size_t i = 0; i < size(); i ++) {
+        (*this)[i].from = std::move(from[i]);
+        (*this)[i].to = std::move(to[i]);
+      }
+    }
+};
+
+/**
+ * Runs fn for iters times and prints ns/op, allocations/op, allocated
+ * bytes/op and the wire size fn reports for one op.
+ **/
+static void run(const char* name, int iters, std::function<size_t()> fn) {
+  // warm up caches and lazily initialized statics
+  for(int i = 0; i < iters / 10 + 1; i ++) fn();
+
+  size_t wire = 0;
+  size_t count = g_alloc_count;
+  size_t bytes = g_alloc_bytes;
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iters; i ++) {
+    wire = fn();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  printf("%-36s %12.1f ns/op %10.1f allocs/op %12.1f alloc-bytes/op %10zu wire-bytes/op\n",
+         name, ns / iters,
+         (double)(g_alloc_count - count) / iters,
+         (double)(g_alloc_bytes - bytes) / iters,
+         wire);
+}
+
+static Rectangle make_rectangle() {
+  Rectangle r;
+  r.from.x = 12;
+  r.from.y = "upper-left";
+  r.to.x = 4096;
+  r.to.y = "lower-right";
+  return r;
+}
+
+static std::vector<int> make_vector(int n) {
+  std::vector<int> v(n);
+  for(int i = 0; i < n; i ++) v[i] = (i * 7919) % 100003 - 50000;
+  return v;
+}
+
+/**
+ * Encode args the way a generated client does and return the request text
+ **/
+template<class T>
+static std::string encode_request(T& arg) {
+  OutSerializer sout;
+  sout & arg;
+  return Proto::build_request(1234, 0, 42, 1400000000, 987654321, sout);
+}
+
+/**
+ * Encode a result the way a generated service wrapper does and return the
+ * response text
+ **/
+template<class T>
+static std::string encode_response(T& result) {
+  Response resp;
+  resp.get_serializer() & result;
+  return Proto::build_response(resp);
+}
+
+template<class T>
+static void bench_payload(const std::string& label, T value, int iters) {
+  std::string req = encode_request(value);
+  std::string resp = encode_response(value);
+
+  run((label + " OutSerializer").c_str(), iters, [&]() -> size_t {
+    OutSerializer sout;
+    sout & value;
+    delete sout.getContent();
+    return 0;
+  });
+
+  run((label + " InSerializer").c_str(), iters, [&]() -> size_t {
+    PError err;
+    JValue* json = loads(resp, err);
+    InSerializer sin(json->get(Result));
+    T out;
+    sin & out;
+    delete json;
+    return resp.size();
+  });
+
+  run((label + " build_request(client)").c_str(), iters, [&]() -> size_t {
+    return encode_request(value).size();
+  });
+
+  run((label + " RequestEncoder(client)").c_str(), iters, [&]() -> size_t {
+    RequestEncoder req(1234, 42, 1400000000, 987654321);
+    req.arg(value);
+    return req.finish().size();
+  });
+
+  run((label + " build_request(server)").c_str(), iters, [&]() -> size_t {
+    Request request = Proto::build_request(req);
+    T out;
+    request.get_serializer() & out;
+    return req.size();
+  });
+
+  run((label + " build_response").c_str(), iters, [&]() -> size_t {
+    return encode_response(value).size();
+  });
+
+  run((label + " write_response(pooled)").c_str(), iters, [&]() -> size_t {
+    Response r;
+    r.get_serializer() & value;
+    FrameBuffer* frame = FramePool::get_instance().acquire();
+    Proto::write_response(r, *frame);
+    size_t size = frame->size();
+    FramePool::get_instance().release(frame);
+    return size;
+  });
+
+  run((label + " parse_response").c_str(), iters, [&]() -> size_t {
+    JValue* json = Proto::parse_response(resp);
+    delete json;
+    return resp.size();
+  });
+}
+
+/**
+ * Same round trips for a NumArray, whose values go through the attachment
+ * section as text
+ **/
+template<class T>
+static void bench_numeric(const std::string& label, NumArray<T> value, int iters) {
+  std::string resp;
+  {
+    Response r;
+    AttachmentScope scope(nullptr, &r.attachments());
+    r.get_serializer() & value;
+    resp = Proto::build_response(r);
+  }
+
+  run((label + " build_response").c_str(), iters, [&]() -> size_t {
+    Response r;
+    AttachmentScope scope(nullptr, &r.attachments());
+    r.get_serializer() & value;
+    return Proto::build_response(r).size();
+  });
+
+  run((label + " parse_response+decode").c_str(), iters, [&]() -> size_t {
+    std::string attachments;
+    JValue* json = Proto::parse_response(resp, &attachments);
+    AttachmentScope scope(&attachments, nullptr);
+    InSerializer sin(json->get(Result));
+    NumArray<T> out;
+    sin & out;
+    delete json;
+    return resp.size();
+  });
+}
+
+int main(int argc, char** argv) {
+  int iters = 20000;
+  if (argc > 1) {
+    iters = atoi(argv[1]);
+  }
+
+  bench_payload("int", 42, iters);
+  bench_payload("Rectangle", make_rectangle(), iters);
+  bench_payload("vector<int>[16]", make_vector(16), iters);
+  bench_payload("vector<int>[4096]", make_vector(4096), iters / 100 + 1);
+
+  std::vector<Rectangle> rects(256, make_rectangle());
+  bench_payload("vector<Rectangle>[256]", rects, iters / 50 + 1);
+  bench_payload("RectangleVector[256]", RectangleVector(rects), iters / 50 + 1);
+
+  printf("numeric kernel: %s\n", numeric::kernel());
+  bench_numeric("NumArray<int>[16]", NumArray<int>(make_vector(16)), iters);
+  bench_numeric("NumArray<int>[4096]", NumArray<int>(make_vector(4096)), iters / 100 + 1);
+
+  std::vector<int> ints = make_vector(4096);
+  NumArray<double> reals(ints.size());
+  for(size_t i = 0; i < ints.size(); i ++) reals[i] = ints[i] / 64.0;
+  bench_numeric("NumArray<double>[4096]", reals, iters / 100 + 1);
+  return 0;
+}
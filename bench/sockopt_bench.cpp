@@ -0,0 +1,139 @@
+#include "json-rpc/all.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+ * Round trip latency of a small echo call over loopback tcp, for each socket
+ * option on its own, applied on both ends.
+ **/
+
+static const int ECHO = 1;
+
+class EchoService : public AbstractService<EchoService> {
+    void _echo_wrapper(Request* req) {
+      InSerializer& sin = req->get_serializer();
+      std::string _arg0;
+      sin & _arg0;
+
+      OutSerializer& sout = req->get_response().get_serializer();
+      sout & _arg0;
+    }
+
+  public:
+    EchoService(ServerConnector& server) : AbstractService<EchoService>(server) {
+      register_service();
+    }
+
+    void _reg_wrappers() {
+      reg(ECHO, &EchoService::_echo_wrapper);
+    }
+};
+
+class EchoClient : public AbstractClient {
+  public:
+    EchoClient(ClientConnector& client) : AbstractClient(client) {}
+
+    std::string echo(std::string msg) {
+      OutSerializer sout;
+      sout & msg;
+      std::string __r;
+      call(ECHO, sout, &__r);
+      return __r;
+    }
+};
+
+struct Config {
+  const char* name;
+  SocketOptions options;
+};
+
+static std::vector<Config> make_configs() {
+  std::vector<Config> configs;
+  Config c;
+
+  c.name = "default";
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "TCP_NODELAY";
+  c.options.nodelay = true;
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "TCP_QUICKACK";
+  c.options.quickack = true;
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "TCP_NODELAY+TCP_QUICKACK";
+  c.options.nodelay = true;
+  c.options.quickack = true;
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "SO_SNDBUF/SO_RCVBUF=256K";
+  c.options.sndbuf = 256 * KB;
+  c.options.rcvbuf = 256 * KB;
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "SO_BUSY_POLL=50us";
+  c.options.busy_poll = 50;
+  configs.push_back(c);
+
+  c = Config();
+  c.name = "TCP_FASTOPEN";
+  c.options.fastopen = 16;
+  configs.push_back(c);
+
+  return configs;
+}
+
+int main(int argc, char** argv) {
+  int calls = 2000;
+  int payload = 64;
+  if (argc > 1) calls = atoi(argv[1]);
+  if (argc > 2) payload = atoi(argv[2]);
+
+  std::vector<Config> configs = make_configs();
+  std::string msg(payload, 'x');
+
+  printf("%-28s %10s %10s %10s %10s\n", "option", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+  for(size_t i = 0; i < configs.size(); i ++) {
+    std::string port = VarString::itos(18200 + i);
+
+    PollServer server(port);
+    server.set_socket_options(configs[i].options);
+    EchoService service(server);
+    service.listen();
+
+    SockClient sclient("127.0.0.1", port);
+    sclient.set_socket_options(configs[i].options);
+    EchoClient client(sclient);
+
+    // warm up connection and thread pool
+    for(int j = 0; j < 100; j ++) client.echo(msg);
+
+    std::vector<double> lat(calls);
+    for(int j = 0; j < calls; j ++) {
+      auto start = std::chrono::steady_clock::now();
+      client.echo(msg);
+      auto end = std::chrono::steady_clock::now();
+      lat[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000.0;
+    }
+
+    double sum = 0;
+    for(int j = 0; j < calls; j ++) sum += lat[j];
+    std::sort(lat.begin(), lat.end());
+
+    printf("%-28s %10.1f %10.1f %10.1f %10.1f\n", configs[i].name,
+           sum / calls, lat[calls / 2], lat[calls * 99 / 100], lat[calls - 1]);
+    service.stop();
+  }
+  return 0;
+}
@@ -2,10 +2,25 @@
 #define __JSONRPC_ALL_HPP__
 
 #include "json-rpc/client/client.hpp"
+#include "json-rpc/client/encoder.hpp"
 #include "json-rpc/server/service.hpp"
+#include "json-rpc/server/stream.hpp"
+#include "json-rpc/server/resultcache.hpp"
+#include "json-rpc/server/coalescer.hpp"
+#include "json-rpc/server/batcher.hpp"
+#include "json-rpc/server/responder.hpp"
+#include "json-rpc/task.hpp"
+#include "json-rpc/bytes.hpp"
+#include "json-rpc/numarray.hpp"
+#include "json-rpc/podarray.hpp"
 #include "json-rpc/client/sockclient.hpp"
+#include "json-rpc/client/muxclient.hpp"
 #include "json-rpc/server/sockserver.hpp"
 #include "json-rpc/server/pollserver.hpp"
+#include "json-rpc/client/shmclient.hpp"
+#include "json-rpc/server/shmserver.hpp"
+#include "json-rpc/client/loopclient.hpp"
+#include "json-rpc/server/loopserver.hpp"
 #include "json-rpc/errors.hpp"
 
 #endif
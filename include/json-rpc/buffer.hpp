@@ -162,6 +162,7 @@ class SizedWRONBuffer : public WRONBuffer {
     }
 
     inline bool ready() { return _pos == _size;}
+    inline size_t remaining() { return _size - _pos; }
 };
 
 #endif
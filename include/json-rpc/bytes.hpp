@@ -0,0 +1,103 @@
+#ifndef __JSONRPC_BYTES_HPP__
+#define __JSONRPC_BYTES_HPP__
+
+#include "jconer/json.hpp"
+
+#include <string>
+
+using namespace JCONER;
+
+/**
+ * Raw attachment section of a frame. A frame is the json text, optionally
+ * followed by a '\0' and the raw bytes of every Bytes value in it, which the
+ * json refers to as [offset, length]. The scope in effect on a thread tells
+ * Bytes where to read those from and where to append to.
+ *
+ * Scopes nest, the connectors and the generated code open them around
+ * serialization, so they are rarely needed directly.
+ **/
+class AttachmentScope {
+  public:
+    /* Scope building its own attachment section, see outgoing() */
+    AttachmentScope();
+
+    /* Reads resolve against in and writes append to out, either can be
+     * nullptr
+     */
+    AttachmentScope(const std::string* in, std::string* out);
+
+    ~AttachmentScope();
+
+    static AttachmentScope* current();
+
+    /* The section built by the innermost scope, if that scope owns it. A
+     * client call started inside a handler doesn't pick up the attachments
+     * of the handler's response this way.
+     */
+    static const std::string& outgoing();
+
+    bool writable() const { return _out != nullptr; }
+    const std::string& output() const { return *_out; }
+
+    /* Append len bytes and return their offset */
+    size_t append(const char* data, size_t len);
+
+    /* Section being built, for values that encode straight into it */
+    std::string& buffer() { return *_out; }
+
+    /* Copy len bytes from offset to value, false if out of range */
+    bool fetch(size_t offset, size_t len, std::string& value) const;
+
+    /* Pointer to len bytes at offset, nullptr if out of range */
+    const char* view(size_t offset, size_t len) const;
+
+  private:
+    const std::string* _in;
+    std::string* _out;
+    std::string _own;
+    AttachmentScope* _prev;
+
+    AttachmentScope(const AttachmentScope&);
+    AttachmentScope& operator=(const AttachmentScope&);
+};
+
+/**
+ * Binary value, "bytes" (or "blob") in a spec. It travels in the attachment
+ * section of the frame instead of as json text, so there is no escaping and
+ * no parsing of the payload.
+ **/
+class Bytes {
+  public:
+    Bytes() {}
+    Bytes(const char* data, size_t len) : _data(data, len) {}
+    Bytes(std::string data) : _data(std::move(data)) {}
+
+    const char* data() const { return _data.data(); }
+    size_t size() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+
+    std::string& str() { return _data; }
+    const std::string& str() const { return _data; }
+
+    bool operator==(const Bytes& o) const { return _data == o._data; }
+    bool operator!=(const Bytes& o) const { return _data != o._data; }
+
+    void seralize(OutSerializer& serializer);
+    void seralize(InSerializer& serializer);
+
+  private:
+    std::string _data;
+};
+
+/**
+ * Split a frame into its json text and attachment section. Returns the
+ * json text, which is the whole frame if there are no attachments.
+ **/
+std::string split_frame(const std::string& frame, std::string* attachments);
+
+/**
+ * Join json text and attachment section into one frame
+ **/
+void join_frame(std::string& json, const std::string& attachments);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __JSONRPC_ASYNCCALL_HPP__
+#define __JSONRPC_ASYNCCALL_HPP__
+
+#include "json-rpc/task.hpp"
+
+#ifdef JSONRPC_HAS_COROUTINES
+
+#include "json-rpc/client/cconn.hpp"
+#include "json-rpc/errors.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <string>
+
+/**
+ * What the co_ methods of generated clients co_await, see
+ * AbstractClient::call_async. Sends the request through
+ * ClientConnector::send_async and resumes the coroutine with the parsed
+ * result once the response came, on the thread the connector runs callbacks
+ * on (MuxClient::set_executor). Lost
+ * connections are retried like blocking calls are.
+ **/
+class AsyncCall {
+  public:
+    AsyncCall(ClientConnector& client, std::string msg,
+              std::function<void(std::string&)> parse)
+        : _client(client), _msg(std::move(msg)), _parse(parse), _tried(0), _state(SENDING) {
+    }
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      _handle = handle;
+      _send();
+      // answered before it got here, go on without suspending
+      return _state.exchange(SUSPENDED) != DONE;
+    }
+
+    void await_resume() {
+      if (_error) {
+        std::rethrow_exception(_error);
+      }
+      _parse(_result);
+    }
+
+  private:
+    enum {
+      SENDING = 0,
+      SUSPENDED = 1,
+      DONE = 2
+    };
+
+    static const int MAX_TRY = 8;
+
+    ClientConnector& _client;
+    std::string _msg;
+    std::function<void(std::string&)> _parse;
+    int _tried;
+
+    std::coroutine_handle<> _handle;
+    std::atomic<int> _state;
+    std::string _result;
+    std::exception_ptr _error;
+
+    void _send() {
+      _client.send_async(_msg, [this](std::string& result, std::exception_ptr error) {
+        _on_response(result, error);
+      });
+    }
+
+    void _on_response(std::string& result, std::exception_ptr error) {
+      if (error) {
+        try {
+          std::rethrow_exception(error);
+        } catch(ServerCloseSocketException& e) {
+          _client.reconnect();
+          _send();
+          return;
+        } catch(ReadFailException& e) {
+          if (++ _tried <= MAX_TRY) {
+            _send();
+            return;
+          }
+        } catch(WriteFailException& e) {
+          if (++ _tried <= MAX_TRY) {
+            _send();
+            return;
+          }
+        } catch(...) {
+        }
+      }
+
+      _result.swap(result);
+      _error = error;
+      if (_state.exchange(DONE) == SUSPENDED) {
+        _handle.resume();
+      }
+    }
+};
+
+#endif
+
+#endif
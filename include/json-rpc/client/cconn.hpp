@@ -2,6 +2,11 @@
 #define __JSONRPC_CCONN_HPP__
 
 #include "jconer/json.hpp"
+#include <exception>
+#include <functional>
+#include <stdexcept>
+
+using namespace JCONER;
 
 /**
  * Base client connector for sending and receiving data
@@ -11,6 +16,56 @@ class ClientConnector {
     ClientConnector() {}
     virtual void send_and_response(std::string value, std::string& result) = 0;
     virtual void reconnect() = 0;
+
+    /* Send value and hand every frame coming back to on_frame, until it
+     * returns false. Used by methods with a streamed response.
+     */
+    virtual void send_and_stream(std::string value, std::function<bool(std::string&)> on_frame) {
+      throw std::runtime_error("Client connector doesn't support streaming");
+    }
+
+    /* Send value, then every frame next_frame produces until it returns
+     * false, and receive the response. Used by methods with an uploaded
+     * argument.
+     */
+    virtual void stream_and_response(std::string value, std::function<bool(std::string&)> next_frame,
+                                     std::string& result) {
+      throw std::runtime_error("Client connector doesn't support uploads");
+    }
+
+    /* Send value and hand the response to done, or the exception the call
+     * failed with. Connectors that can wait for it in the background call
+     * done from another thread, the others answer on the caller's thread
+     * before returning.
+     */
+    virtual void send_async(std::string value,
+                            std::function<void(std::string&, std::exception_ptr)> done) {
+      std::string result;
+      std::exception_ptr error;
+      try {
+        send_and_response(value, result);
+      } catch(...) {
+        error = std::current_exception();
+      }
+      done(result, error);
+    }
+
+    /* Connectors that reach a service living in the same process can take
+     * the serializer content as is and skip the text round trip. They return
+     * true and set resp to the response object, which the caller deletes.
+     * The raw sections go along as they are.
+     */
+    virtual bool call_direct(int clientno, int messageid, long timestamp,
+                             size_t method_hash, OutSerializer& sout,
+                             const std::string& attachments, JValue*& resp,
+                             std::string& resp_attachments) {
+      return false;
+    }
+
+    /* True if call_direct takes requests, so they are not worth encoding
+     * as text
+     */
+    virtual bool direct() const { return false; }
 };
 
 #endif
@@ -2,11 +2,18 @@
 #define __JSONRPC_CLIENT_HPP__
 
 #include "json-rpc/client/cconn.hpp"
+#include "json-rpc/client/encoder.hpp"
+#include "json-rpc/client/clientcache.hpp"
+#include "json-rpc/client/asynccall.hpp"
 #include "json-rpc/proto.hpp"
 #include "json-rpc/errors.hpp"
+#include "json-rpc/bytes.hpp"
 #include "jconer/json.hpp"
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <random>
 #include <stdexcept>
 #include <time.h>
 
@@ -21,16 +28,18 @@ using namespace JCONER;
  */
 class AbstractClient {
   public:
-    AbstractClient(ClientConnector& client) : _client(client) {
-      srand(getpid());
-      _clientno = rand();
-      _msg_id = 0;
+    AbstractClient(ClientConnector& client) : _client(client), _msg_id(0) {
+      // clients of one process sharing a MuxClient need their own clientno,
+      // and processes with the same pid (containers) must not collide either
+      static std::atomic<int> instances(0);
+      static const unsigned base = std::random_device()();
+      _clientno = (int)((base + (unsigned)instances ++) & 0x7fffffff);
     }
 
     virtual ~AbstractClient() { }
   private:
     ClientConnector& _client;
-    int _msg_id;
+    std::atomic<int> _msg_id;
     int _clientno;
 
 
@@ -45,14 +54,75 @@ class AbstractClient {
     template<class R>
     void call(size_t method_hash, OutSerializer& sout, R* r);
 
+    /* Start a request, the generated method adds the arguments to it and
+     * hands it to call. The text is written as the arguments come, with no
+     * serializer tree in between. Methods with a ClientCache pass
+     * allow_direct false, their key is the request text.
+     */
+    RequestEncoder begin_request(size_t method_hash, bool allow_direct = true);
+    void call(RequestEncoder& req);
+    template<class R>
+    void call(RequestEncoder& req, R* r);
+
+    /* Call function w/ streamed return value, on_item gets every element
+     * as soon as its frame arrives
+     */
+    template<class R>
+    void call_stream(size_t method_hash, OutSerializer& sout, std::function<void(R&)> on_item);
+
+    /* Call function with an uploaded argument, every element source gives
+     * out goes to the server as its own frame, until source returns false
+     */
+    template<class T>
+    void call_upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source);
+
+    template<class T, class R>
+    void call_upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source, R* r);
+
+#ifdef JSONRPC_HAS_COROUTINES
+    /* co_await-able call of a request text made by a RequestEncoder, for
+     * the co_ methods of generated clients. r gets the result.
+     */
+    AsyncCall call_async(std::string msg) {
+      return AsyncCall(_client, std::move(msg), [this](std::string& rst) {
+        _parse_response(rst);
+      });
+    }
+
+    template<class R>
+    AsyncCall call_async(std::string msg, R* r) {
+      return AsyncCall(_client, std::move(msg), [this, r](std::string& rst) {
+        _parse_response(rst, *r);
+      });
+    }
+#endif
+
   private:
+    std::string _send_request(RequestEncoder& req);
+    template<class T>
+      std::string _upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source);
     void _parse_response(std::string response);
     template<class R>
       void _parse_response(std::string response, R& r);
+    template<class R>
+      void _take_result(JValue* json_resp, R& r, const std::string& attachments);
 };
 
 void AbstractClient::call(size_t method_hash, OutSerializer& sout) {
-  std::string msg = Proto::build_request(_clientno, 0, _msg_id ++, time(0), method_hash, sout);
+  int msg_id = _msg_id ++;
+  // Bytes arguments were written to the scope the generated method opened
+  const std::string& attachments = AttachmentScope::outgoing();
+  JValue* resp = nullptr;
+  std::string resp_attachments;
+  if (_client.call_direct(_clientno, msg_id, time(0), method_hash, sout,
+                          attachments, resp, resp_attachments)) {
+    Proto::check_response(resp);
+    delete resp;
+    return;
+  }
+
+  std::string msg = Proto::build_request(_clientno, 0, msg_id, time(0), method_hash, sout,
+                                         false, attachments);
 
   int tried = 0;
   static const int MAX_TRY = 8;
@@ -80,7 +150,19 @@ void AbstractClient::call(size_t method_hash, OutSerializer& sout) {
 
 template<class R>
 void AbstractClient::call (size_t method_hash, OutSerializer& sout, R* r) {
-  std::string msg = Proto::build_request(_clientno, 0, _msg_id ++, time(0), method_hash, sout);
+  int msg_id = _msg_id ++;
+  const std::string& attachments = AttachmentScope::outgoing();
+  JValue* resp = nullptr;
+  std::string resp_attachments;
+  if (_client.call_direct(_clientno, msg_id, time(0), method_hash, sout,
+                          attachments, resp, resp_attachments)) {
+    Proto::check_response(resp);
+    _take_result(resp, *r, resp_attachments);
+    return;
+  }
+
+  std::string msg = Proto::build_request(_clientno, 0, msg_id, time(0), method_hash, sout,
+                                         false, attachments);
 
   int tried = 0;
   static const int MAX_TRY = 8;
@@ -105,6 +187,166 @@ void AbstractClient::call (size_t method_hash, OutSerializer& sout, R* r) {
   }
 }
 
+RequestEncoder AbstractClient::begin_request(size_t method_hash, bool allow_direct) {
+  return RequestEncoder(_clientno, _msg_id ++, time(0), method_hash,
+                        allow_direct && _client.direct());
+}
+
+void AbstractClient::call(RequestEncoder& req) {
+  const std::string& attachments = AttachmentScope::outgoing();
+  JValue* resp = nullptr;
+  std::string resp_attachments;
+  if (req.direct() &&
+      _client.call_direct(_clientno, req.messageid(), req.timestamp(), req.method_hash(),
+                          req.serializer(), attachments, resp, resp_attachments)) {
+    Proto::check_response(resp);
+    delete resp;
+    return;
+  }
+  _parse_response(_send_request(req));
+}
+
+template<class R>
+void AbstractClient::call(RequestEncoder& req, R* r) {
+  const std::string& attachments = AttachmentScope::outgoing();
+  JValue* resp = nullptr;
+  std::string resp_attachments;
+  if (req.direct() &&
+      _client.call_direct(_clientno, req.messageid(), req.timestamp(), req.method_hash(),
+                          req.serializer(), attachments, resp, resp_attachments)) {
+    Proto::check_response(resp);
+    _take_result(resp, *r, resp_attachments);
+    return;
+  }
+  _parse_response(_send_request(req), *r);
+}
+
+/* Send the request text, retrying on a new connection, and return the
+ * response text
+ */
+std::string AbstractClient::_send_request(RequestEncoder& req) {
+  std::string msg = req.finish(AttachmentScope::outgoing());
+
+  int tried = 0;
+  static const int MAX_TRY = 8;
+
+  while (true) {
+    try {
+      std::string rst;
+      _client.send_and_response(msg, rst);
+      return rst;
+    } catch(ServerCloseSocketException& e) {
+      _client.reconnect();
+    } catch (ReadFailException & e ) {
+      if (++ tried > MAX_TRY) throw std::runtime_error("PRC call failed");
+    } catch (WriteFailException & e) {
+      if (++ tried > MAX_TRY) throw std::runtime_error("PRC call failed");
+    }
+  }
+}
+
+template<class R>
+void AbstractClient::call_stream(size_t method_hash, OutSerializer& sout, std::function<void(R&)> on_item) {
+  std::string msg = Proto::build_request(_clientno, 0, _msg_id ++, time(0), method_hash, sout,
+                                         false, AttachmentScope::outgoing());
+
+  int tried = 0;
+  static const int MAX_TRY = 8;
+
+  // once an element has been handed out the call can't be replayed
+  bool started = false;
+  auto on_frame = [&](std::string& frame) -> bool {
+    std::string attachments;
+    JValue* json_resp = Proto::parse_response(frame, &attachments);
+    if (!json_resp->contain(Chunk)) {
+      delete json_resp;
+      return false;
+    }
+
+    R item;
+    try {
+      AttachmentScope scope(&attachments, nullptr);
+      InSerializer sin(json_resp->get(Chunk));
+      sin & item;
+    } catch (SerializeFailException& e) {
+      delete json_resp;
+      throw;
+    }
+    delete json_resp;
+
+    started = true;
+    on_item(item);
+    return true;
+  };
+
+  while (true) {
+    try {
+      _client.send_and_stream(msg, on_frame);
+      break;
+    } catch(ServerCloseSocketException& e) {
+      if (started) throw;
+      _client.reconnect();
+    } catch (ReadFailException & e ) {
+      if (started || ++ tried > MAX_TRY) throw;
+    } catch (WriteFailException & e) {
+      if (started || ++ tried > MAX_TRY) throw;
+    }
+  }
+}
+
+template<class T>
+void AbstractClient::call_upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source) {
+  _parse_response(_upload(method_hash, sout, source));
+}
+
+template<class T, class R>
+void AbstractClient::call_upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source, R* r) {
+  _parse_response(_upload(method_hash, sout, source), *r);
+}
+
+template<class T>
+std::string AbstractClient::_upload(size_t method_hash, OutSerializer& sout, std::function<bool(T&)> source) {
+  std::string msg = Proto::build_request(_clientno, 0, _msg_id ++, time(0), method_hash, sout,
+                                         true, AttachmentScope::outgoing());
+
+  int tried = 0;
+  static const int MAX_TRY = 8;
+
+  // once source has been pulled the call can't be replayed
+  bool started = false;
+  bool ended = false;
+  auto next_frame = [&](std::string& frame) -> bool {
+    if (ended) return false;
+    started = true;
+
+    T item;
+    if (source(item)) {
+      AttachmentScope scope;
+      OutSerializer chunk;
+      chunk & item;
+      frame = Proto::build_chunk(chunk, scope.output());
+    } else {
+      frame = Proto::build_end();
+      ended = true;
+    }
+    return true;
+  };
+
+  while (true) {
+    try {
+      std::string rst;
+      _client.stream_and_response(msg, next_frame, rst);
+      return rst;
+    } catch(ServerCloseSocketException& e) {
+      if (started) throw;
+      _client.reconnect();
+    } catch (ReadFailException & e ) {
+      if (started || ++ tried > MAX_TRY) throw;
+    } catch (WriteFailException & e) {
+      if (started || ++ tried > MAX_TRY) throw;
+    }
+  }
+}
 
 void AbstractClient::_parse_response(std::string response) {
   JValue* rst = Proto::parse_response(response);
@@ -113,16 +355,27 @@ void AbstractClient::_parse_response(std::string response) {
 
 template<class R>
 void AbstractClient::_parse_response(std::string response, R& r) {
-  JValue* json_resp = Proto::parse_response(response);
+  std::string attachments;
+  JValue* json_resp = Proto::parse_response(response, &attachments);
+  _take_result(json_resp, r, attachments);
+}
 
+template<class R>
+void AbstractClient::_take_result(JValue* json_resp, R& r, const std::string& attachments) {
   if (!json_resp->contain(Result)) {
-    LOG(DEBUG) << VarString::format("Response text format erro, should have result, [%s]\n", response.c_str()) << std::endl;
+    LOG(DEBUG) << "Response format error, should have result" << std::endl;
     delete json_resp;
     throw NoResultException();
   }
 
-  InSerializer sin(json_resp->get(Result));
-  sin & r;
+  try {
+    AttachmentScope scope(&attachments, nullptr);
+    InSerializer sin(json_resp->get(Result));
+    sin & r;
+  } catch (SerializeFailException& e) {
+    delete json_resp;
+    throw;
+  }
   delete json_resp;
 }
 
@@ -0,0 +1,155 @@
+#ifndef __JSONRPC_CLIENTCACHE_HPP__
+#define __JSONRPC_CLIENTCACHE_HPP__
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Results of a client method marked "client_cache" in the spec, keyed by
+ * the encoded arguments (see RequestEncoder::cache_key). A call whose
+ * arguments were seen within ttl_ms doesn't leave the process. Bounded by
+ * max_entries, the least recently used result goes first.
+ *
+ * While a result is being fetched, calls with the same key wait for that
+ * fetch instead of sending their own, and get its result or its exception.
+ **/
+template<class R>
+class ClientCache {
+  public:
+    ClientCache(long ttl_ms, size_t max_entries)
+        : _ttl_ms(ttl_ms), _capacity(max_entries == 0 ? 1 : max_entries) {
+    }
+
+    /* The cached result for key, else the one fetch gets */
+    R get(const std::string& key, std::function<void(R&)> fetch) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true) {
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+          if (it->second.expires_at > _now_ms()) {
+            _lru.splice(_lru.begin(), _lru, it->second.pos);
+            return it->second.value;
+          }
+          _lru.erase(it->second.pos);
+          _entries.erase(it);
+        }
+
+        auto flight = _flights.find(key);
+        if (flight == _flights.end()) {
+          break;
+        }
+        // someone else fetches it, wait for that
+        std::shared_ptr<Flight> pending = flight->second;
+        _cond.wait(lock, [&] { return pending->finished; });
+        if (pending->error) {
+          std::rethrow_exception(pending->error);
+        }
+        if (pending->stored) {
+          return pending->value;
+        }
+      }
+
+      std::shared_ptr<Flight> flight(new Flight());
+      _flights[key] = flight;
+      lock.unlock();
+
+      R value;
+      try {
+        fetch(value);
+      } catch(...) {
+        lock.lock();
+        flight->error = std::current_exception();
+        _finish(key, flight);
+        throw;
+      }
+
+      lock.lock();
+      flight->value = value;
+      flight->stored = true;
+      _store(key, value);
+      _finish(key, flight);
+      return value;
+    }
+
+    void invalidate(const std::string& key) {
+      std::lock_guard<std::mutex> _(_mutex);
+      auto it = _entries.find(key);
+      if (it != _entries.end()) {
+        _lru.erase(it->second.pos);
+        _entries.erase(it);
+      }
+    }
+
+    void clear() {
+      std::lock_guard<std::mutex> _(_mutex);
+      _entries.clear();
+      _lru.clear();
+    }
+
+    size_t size() {
+      std::lock_guard<std::mutex> _(_mutex);
+      return _entries.size();
+    }
+
+  private:
+    struct Entry {
+      R value;
+      uint64_t expires_at;  // ms, steady clock
+      std::list<std::string>::iterator pos;
+    };
+
+    struct Flight {
+      Flight() : finished(false), stored(false) {}
+      bool finished;
+      bool stored;
+      R value;
+      std::exception_ptr error;
+    };
+
+    long _ttl_ms;
+    size_t _capacity;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::unordered_map<std::string, Entry> _entries;
+    std::list<std::string> _lru;  // keys, most recently used first
+    std::unordered_map<std::string, std::shared_ptr<Flight> > _flights;
+
+    void _store(const std::string& key, const R& value) {
+      auto it = _entries.find(key);
+      if (it != _entries.end()) {
+        _lru.erase(it->second.pos);
+        _entries.erase(it);
+      }
+      while (_entries.size() >= _capacity) {
+        _entries.erase(_lru.back());
+        _lru.pop_back();
+      }
+      _lru.push_front(key);
+      Entry& entry = _entries[key];
+      entry.value = value;
+      entry.expires_at = _now_ms() + _ttl_ms;
+      entry.pos = _lru.begin();
+    }
+
+    void _finish(const std::string& key, const std::shared_ptr<Flight>& flight) {
+      flight->finished = true;
+      _flights.erase(key);
+      _cond.notify_all();
+    }
+
+    static uint64_t _now_ms() {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+#endif
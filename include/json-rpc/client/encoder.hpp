@@ -0,0 +1,148 @@
+#ifndef __JSONRPC_ENCODER_HPP__
+#define __JSONRPC_ENCODER_HPP__
+
+#include "json-rpc/frame.hpp"
+#include "json-rpc/bytes.hpp"
+#include "json-rpc/numarray.hpp"
+#include "json-rpc/podarray.hpp"
+#include "jconer/json.hpp"
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace JCONER;
+
+/**
+ * Writes a request as json text while the generated client method hands it
+ * the arguments, the same text Proto::build_request makes, without building
+ * a tree first. The envelope keys are written from precomputed prefixes.
+ *
+ * Numbers, strings, Bytes, NumArray, PodArray and vectors of those are
+ * written directly, other types (generated classes) go through an
+ * OutSerializer.
+ * For connectors taking the serializer content as is (see
+ * ClientConnector::call_direct) every argument goes to an OutSerializer
+ * instead.
+ **/
+class RequestEncoder {
+  public:
+    RequestEncoder(int clientno, int messageid, long timestamp,
+                   size_t method_hash, bool direct = false);
+
+    template<class T>
+    RequestEncoder& arg(const T& value) {
+      if (_sout) {
+        *_sout & const_cast<T&>(value);
+        return *this;
+      }
+      if (_count ++ != 0) _text.push_back(',');
+      _value(value);
+      return *this;
+    }
+
+    /* The request text with attachments after it, the encoder is done
+     * after this
+     */
+    std::string finish(const std::string& attachments = std::string());
+
+    /* The arguments so far with the raw section, what ClientCache keys
+     * on. Empty for a direct encoder.
+     */
+    std::string cache_key(const std::string& attachments) const;
+
+    bool direct() const { return (bool)_sout; }
+    OutSerializer& serializer() { return *_sout; }
+
+    int clientno() const { return _clientno; }
+    int messageid() const { return _messageid; }
+    long timestamp() const { return _timestamp; }
+    size_t method_hash() const { return _method_hash; }
+
+  private:
+    int _clientno;
+    int _messageid;
+    long _timestamp;
+    size_t _method_hash;
+
+    std::string _text;
+    size_t _params_at;  // where the params array starts in _text
+    size_t _count;
+    std::unique_ptr<OutSerializer> _sout;
+
+    void _value(bool value) { _text.append(value ? "true" : "false"); }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value>::type
+    _value(T value) { numeric::append(_text, (long long)value); }
+
+    template<class T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    _value(T value) { write_json_real(_text, value); }
+
+    void _value(const std::string& value) {
+      write_json_string(_text, value.data(), value.size());
+    }
+
+    void _value(const Bytes& value);
+
+    template<class T>
+    void _value(const NumArray<T>& value) {
+      AttachmentScope* scope = AttachmentScope::current();
+      if (scope == nullptr || !scope->writable()) {
+        throw SerializeFailException();
+      }
+
+      std::string& out = scope->buffer();
+      size_t offset = out.size();
+      value.to_text(out);
+      _reference(offset, out.size() - offset);
+    }
+
+    template<class T>
+    void _value(const PodArray<T>& value) {
+      AttachmentScope* scope = AttachmentScope::current();
+      if (scope == nullptr || !scope->writable()) {
+        throw SerializeFailException();
+      }
+
+      // [offset, length, record size, byte order], as PodArray writes it
+      size_t len = value.size() * sizeof(T);
+      _text.push_back('[');
+      numeric::append(_text, (long long)scope->append((const char*)value.data(), len));
+      _text.push_back(',');
+      numeric::append(_text, (long long)len);
+      _text.push_back(',');
+      numeric::append(_text, (long long)sizeof(T));
+      _text.push_back(',');
+      numeric::append(_text, (long long)pod::native_order());
+      _text.push_back(']');
+    }
+
+    template<class T>
+    void _value(const std::vector<T>& value) {
+      _text.push_back('[');
+      for(size_t i = 0; i < value.size(); i ++) {
+        if (i != 0) _text.push_back(',');
+        _value((const T&)value[i]);
+      }
+      _text.push_back(']');
+    }
+
+    /* Anything else serializes itself */
+    template<class T>
+    typename std::enable_if<std::is_class<T>::value>::type
+    _value(const T& value) {
+      OutSerializer sout;
+      sout & const_cast<T&>(value);
+      JValue* content = sout.getContent();
+      write_json(_text, content->get(0));
+      delete content;
+    }
+
+    /* [offset,len] of a value in the attachment section */
+    void _reference(size_t offset, size_t len);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __JSONRPC_LOOPCLIENT_HPP__
+#define __JSONRPC_LOOPCLIENT_HPP__
+
+#include "json-rpc/client/cconn.hpp"
+#include "json-rpc/server/loopserver.hpp"
+
+#include <functional>
+
+/**
+ * A client connector calling a service registered on a LoopbackServer in the
+ * same process. Requests run on the caller's thread, or on executor when one
+ * is given, in which case the caller waits for them to finish. In direct mode
+ * the serializer content is passed to the service as is, with no text in
+ * between.
+ */
+class LoopbackClient : public ClientConnector {
+  public:
+    typedef std::function<void(std::function<void()>)> Executor;
+
+    LoopbackClient(LoopbackServer& server, bool direct = true, Executor executor = nullptr)
+        : _server(server), _direct(direct), _executor(executor) {
+    }
+
+    void send_and_response(std::string value, std::string& result);
+    void send_and_stream(std::string value, std::function<bool(std::string&)> on_frame);
+    void stream_and_response(std::string value, std::function<bool(std::string&)> next_frame,
+                             std::string& result);
+    void reconnect() {}
+
+    bool call_direct(int clientno, int messageid, long timestamp,
+                     size_t method_hash, OutSerializer& sout,
+                     const std::string& attachments, JValue*& resp,
+                     std::string& resp_attachments);
+    bool direct() const { return _direct; }
+
+  private:
+    LoopbackServer& _server;
+    bool _direct;
+    Executor _executor;
+
+    void _run(std::function<void()> job);
+};
+
+#endif
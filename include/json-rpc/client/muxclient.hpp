@@ -0,0 +1,134 @@
+#ifndef __JSONRPC_MUXCLIENT_HPP__
+#define __JSONRPC_MUXCLIENT_HPP__
+
+#include "json-rpc/client/cconn.hpp"
+#include "json-rpc/util.hpp"
+#include "json-rpc/sockopt.hpp"
+#include "common/all.hpp"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A socket client connector many threads can call at once over a single
+ * connection. A request waits up to flush_us for the requests of other
+ * callers (or until flush_bytes are queued), then they are written together
+ * with one writev. A reader thread hands every response to the caller
+ * waiting for its clientno and messageid, responses may come back in any
+ * order.
+ *
+ * send_async queues the request without waiting, it is written right away
+ * unless a caller is already gathering a batch. Its done callback runs on
+ * the executor (see set_executor), never on the reader thread: a callback
+ * making a blocking call on the same client would wait for itself, and
+ * slow ones would hold up every other response.
+ *
+ * Methods with a streamed response or an uploaded argument aren't
+ * supported.
+ */
+class MuxClient : public ClientConnector {
+  public:
+    typedef std::function<void(std::function<void()>)> Executor;
+
+    MuxClient(std::string host, std::string port, long flush_us = 50,
+              size_t flush_bytes = 64 * 1024);
+    MuxClient(UnixPath path, long flush_us = 50, size_t flush_bytes = 64 * 1024);
+    ~MuxClient();
+
+    void send_and_response(std::string value, std::string& result);
+    void send_async(std::string value,
+                    std::function<void(std::string&, std::exception_ptr)> done);
+    void reconnect();
+
+    /* Applied on the next (re)connect */
+    void set_socket_options(const SocketOptions& options) {
+      _options = options;
+    }
+
+    /* Where send_async callbacks run, PollServer::executor to resume
+     * handlers on the server's workers. By default on a thread pool of the
+     * client's own, started with the first callback. Set it before the
+     * first call.
+     */
+    void set_executor(Executor executor) { _executor = executor; }
+
+    /* Requests written so far, and the writev batches they went out in */
+    uint64_t frames_sent();
+    uint64_t flushes();
+
+  private:
+    enum {
+      OK = 0,
+      READ_FAIL = 1,
+      WRITE_FAIL = 2
+    };
+
+    struct Call {
+      Call(std::string* r) : result(r), done(false), error(OK) {}
+      std::string* result;
+      bool done;
+      int error;
+      std::condition_variable cond;
+      // set for send_async, which owns the call
+      std::function<void(std::string&, std::exception_ptr)> on_done;
+    };
+
+    std::string _host;
+    std::string _port;
+    struct addrinfo* _server_info;
+    std::string _unix_path; // empty unless connecting to a unix domain socket
+    int _family;
+    SocketOptions _options;
+
+    std::chrono::microseconds _flush_window;
+    size_t _flush_bytes;
+
+    std::mutex _mutex;
+    int _sock;
+    // bumped whenever the connection is dropped, a reader or a flush of an
+    // older connection leaves the current one alone
+    std::atomic<uint64_t> _generation;
+    std::unordered_map<uint64_t, Call*> _calls;  // by clientno and messageid
+    std::vector<Call*> _failed;                  // send_async calls a reader fails
+    bool _closing;                               // destructor runs, no new connections
+    std::vector<std::string> _queue;             // requests not written yet
+    size_t _queued_bytes;
+    bool _flushing;                              // a caller waits to write _queue
+    std::condition_variable _flush_cond;
+    uint64_t _frames_sent;
+    uint64_t _flushes;
+
+    // held while writing, and while a reader closes its socket
+    std::mutex _write_mutex;
+    std::map<uint64_t, std::thread> _readers;    // by generation
+    std::vector<uint64_t> _exited;               // readers that are done, joined on connect
+
+    Executor _executor;
+    std::once_flag _pool_once;
+    std::unique_ptr<ThreadPool> _pool;   // unless there is an executor
+
+    void _connect();
+    void _reap();
+    void _flush(std::unique_lock<std::mutex>& lock);
+    void _drop(uint64_t generation, int error);
+    void _read_loop(int sock, uint64_t generation);
+    bool _deliver(std::string& frame);
+    void _done(Call* call, std::string& result, std::exception_ptr error);
+    void _enqueue(uint64_t key, std::string& message, Call* call);
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __JSONRPC_SHMCLIENT_HPP__
+#define __JSONRPC_SHMCLIENT_HPP__
+
+#include "json-rpc/client/cconn.hpp"
+#include "json-rpc/buffer.hpp"
+#include "json-rpc/shmring.hpp"
+#include "json-rpc/util.hpp"
+
+/**
+ * A client connector exchanging frames with a ShmServer on the same host
+ * through shared memory rings. The unix domain socket at path is only used
+ * to hand over the segment and to notice when the server dies.
+ */
+class ShmClient : public ClientConnector {
+  public:
+    ShmClient(UnixPath path, size_t capacity = MB);
+    ~ShmClient();
+
+    void send_and_response(std::string value, std::string& result);
+    void send_and_stream(std::string value, std::function<bool(std::string&)> on_frame);
+    void stream_and_response(std::string value, std::function<bool(std::string&)> next_frame,
+                             std::string& result);
+    void reconnect();
+
+  private:
+    std::string _path;
+    size_t _capacity;
+    int _sock;
+    ShmSegment* _segment;
+
+    void _close();
+};
+
+#endif
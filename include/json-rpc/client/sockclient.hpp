@@ -2,6 +2,8 @@
 #define __JSONRPC_SOCKCLIENT_HPP__
 
 #include "json-rpc/client/cconn.hpp"
+#include "json-rpc/util.hpp"
+#include "json-rpc/sockopt.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -10,15 +12,25 @@
 #include <unistd.h>
  
 /**
- * A tpc socket client connector
+ * A socket client connector, over tcp or over a unix domain socket
  */
 class SockClient : public ClientConnector {
   public:
     SockClient(std::string host, std::string port);
+    SockClient(UnixPath path);
     ~SockClient();
 
     void send_and_response(std::string value, std::string& result);
+    void send_and_stream(std::string value, std::function<bool(std::string&)> on_frame);
+    void stream_and_response(std::string value, std::function<bool(std::string&)> next_frame,
+                             std::string& result);
     void reconnect();
+
+    /* Applied on the next (re)connect */
+    void set_socket_options(const SocketOptions& options) {
+      _options = options;
+    }
+
   private:
   
     void _send(const std::string &msg);
@@ -28,6 +40,11 @@ class SockClient : public ClientConnector {
     std::string _host;
     std::string _port;
     struct addrinfo* _server_info;
+    std::string _unix_path; // empty unless connecting to a unix domain socket
+    int _family;
+    SocketOptions _options;
+
+    void _connect_unix();
 };
 
 #endif
@@ -73,6 +73,30 @@ class ServerParamMismatchException : public ServerException {
     }
 };
 
+/**
+ * The handler of a deferred response failed with something else than a
+ * ServerException, see Request::defer.
+ **/
+class ServerHandlerFailedException : public ServerException {
+  public:
+    ServerHandlerFailedException(): ServerException(Proto::HANDLER_FAILED) {}
+    const char* what() const throw() {
+      return "Handler failed in server";
+    }
+};
+
+/**
+ * The server didn't answer the request within its request timeout, see
+ * PollServer::set_request_timeout. The method may still have run.
+ **/
+class ServerDeadlineExceededException : public ServerException {
+  public:
+    ServerDeadlineExceededException(): ServerException(Proto::DEADLINE_EXCEEDED) {}
+    const char* what() const throw() {
+      return "Deadline exceeded in server";
+    }
+};
+
 /**
  * When client calls a method that has a return value but the response from
  * server doesn' have one. This will never happen if users don't change the
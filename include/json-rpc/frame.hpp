@@ -0,0 +1,103 @@
+#ifndef __JSONRPC_FRAME_HPP__
+#define __JSONRPC_FRAME_HPP__
+
+#include "json-rpc/buffer.hpp"
+#include "jconer/json.hpp"
+#include "common/all.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace JCONER;
+
+/**
+ * Outgoing frame, the 4 byte length prefix followed by the message. Room for
+ * the prefix is kept at the front, so a message can be written in place and
+ * the whole buffer handed to the socket as is.
+ **/
+class FrameBuffer {
+  public:
+    FrameBuffer() {
+      clear();
+    }
+
+    /* Start over with an empty message */
+    void clear() {
+      _buf.resize(sizeof(int));
+    }
+
+    void append(const char* data, size_t len) { _buf.insert(_buf.end(), data, data + len); }
+    void append(const std::string& data) { append(data.data(), data.size()); }
+    void push_back(char c) { _buf.push_back(c); }
+    void reserve(size_t len) { _buf.reserve(sizeof(int) + len); }
+
+    /* Write the length prefix, call when the message is complete */
+    void finish() {
+      int size = payload_size();
+      memcpy(&_buf[0], &size, sizeof(int));
+    }
+
+    /* The whole frame, prefix included */
+    const char* data() const { return _buf.data(); }
+    size_t size() const { return _buf.size(); }
+
+    /* The message only */
+    const char* payload() const { return _buf.data() + sizeof(int); }
+    size_t payload_size() const { return _buf.size() - sizeof(int); }
+
+    size_t capacity() const { return _buf.capacity(); }
+
+  private:
+    std::vector<char> _buf;
+};
+
+/**
+ * Keeps released frame buffers for reuse, so sending a response doesn't
+ * allocate once the buffers have grown to the usual message size. Very large
+ * buffers are dropped instead of kept.
+ **/
+class FramePool {
+  CLASS_NOCOPY(FramePool)
+  public:
+    static const size_t MAX_POOLED = 64;
+    static const size_t MAX_POOLED_CAPACITY = 4 * MB;
+
+    static FramePool& get_instance() { return _instance; }
+    ~FramePool();
+
+    /* An empty buffer, either reused or new */
+    FrameBuffer* acquire();
+    void release(FrameBuffer* frame);
+
+  private:
+    Mutex _mutex;
+    std::vector<FrameBuffer*> _free;
+
+    static FramePool _instance;
+    FramePool() {}
+};
+
+/**
+ * Json text of value, the same dumps() would produce, appended to out
+ **/
+void write_json(FrameBuffer& out, JValue* value);
+void write_json(std::string& out, JValue* value);
+
+/* Pieces of the above, for encoders writing json text without a tree */
+void write_json_string(std::string& out, const char* str, size_t len);
+void write_json_real(std::string& out, double value);
+
+/**
+ * Write a whole frame to a blocking socket, retrying short writes. The
+ * message version gathers the length prefix and msg with writev instead of
+ * copying them together. Both return false if the socket failed.
+ **/
+bool send_frame(int sock, const FrameBuffer& frame);
+bool send_frame(int sock, const char* msg, size_t len);
+
+/* Several messages as consecutive frames, gathered into as few writev
+ * calls as the iovec limit allows
+ */
+bool send_frames(int sock, const std::vector<std::string>& msgs);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef __JSONRPC_MPSCQUEUE_HPP__
+#define __JSONRPC_MPSCQUEUE_HPP__
+
+#include <atomic>
+#include <utility>
+
+/**
+ * Unbounded multi producer single consumer queue (Vyukov's intrusive
+ * node queue). push is wait free, one exchange and one store, and never
+ * takes a lock. Only one thread may pop. pop can come back empty handed
+ * while a push is half done, the pushing thread is expected to wake the
+ * consumer afterwards anyway.
+ **/
+template<class T>
+class MpscQueue {
+  public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) {
+      _stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~MpscQueue() {
+      T value;
+      while (pop(value)) {
+      }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+      _push(new Node(std::move(value)));
+    }
+
+    /* Consumer side, false if there is nothing to take right now */
+    bool pop(T& value) {
+      Node* tail = _tail;
+      Node* next = tail->next.load(std::memory_order_acquire);
+      if (tail == &_stub) {
+        if (next == nullptr) {
+          return false;
+        }
+        _tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if (next == nullptr) {
+        if (tail != _head.load(std::memory_order_acquire)) {
+          // a producer swapped the head but didn't link its node yet
+          return false;
+        }
+        // tail is the last node, put the stub behind it so it can go
+        _push(&_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+          return false;
+        }
+      }
+
+      _tail = next;
+      value = std::move(tail->value);
+      delete tail;
+      return true;
+    }
+
+  private:
+    struct Node {
+      Node() {}
+      explicit Node(T v) : value(std::move(v)) {}
+
+      std::atomic<Node*> next;
+      T value;
+    };
+
+    void _push(Node* node) {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      Node* prev = _head.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    std::atomic<Node*> _head; // producers
+    char _pad[64];            // keeps producers off the consumer's line
+    Node* _tail;              // consumer
+    Node _stub;
+};
+
+#endif
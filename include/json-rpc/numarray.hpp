@@ -0,0 +1,164 @@
+#ifndef __JSONRPC_NUMARRAY_HPP__
+#define __JSONRPC_NUMARRAY_HPP__
+
+#include "json-rpc/bytes.hpp"
+#include "jconer/json.hpp"
+
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace JCONER;
+
+/**
+ * Text codec for arrays of numbers, "1,-2,30". Validation runs over the
+ * whole text at once with SSE4.2 or AVX2 when the cpu has it, picked at
+ * runtime, and a scalar loop otherwise. Runs of eight digits are converted
+ * in one step.
+ **/
+namespace numeric {
+  /* Check that text only holds characters a number array can have and
+   * count the separators. real allows '.', 'e' and 'E'.
+   */
+  bool validate(const char* text, size_t len, bool real, size_t& separators);
+
+  /* Name of the validation kernel in use, "avx2", "sse4.2" or "scalar" */
+  const char* kernel();
+
+  void append(std::string& out, long long value);
+  /* NaN and infinities are written as null */
+  void append(std::string& out, double value);
+
+  /* Parse one number at p and move p past it, false if there is none or it
+   * doesn't fit. A real may also be null, read as NaN.
+   */
+  bool parse(const char*& p, const char* end, long long& value);
+  bool parse(const char*& p, const char* end, double& value);
+
+  inline void skip_space(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p ++;
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value, bool>::type
+  parse_as(const char*& p, const char* end, T& value) {
+    long long v;
+    if (!parse(p, end, v) ||
+        v < (long long)std::numeric_limits<T>::min() ||
+        (v > 0 && (unsigned long long)v > (unsigned long long)std::numeric_limits<T>::max())) {
+      return false;
+    }
+    value = (T)v;
+    return true;
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+  parse_as(const char*& p, const char* end, T& value) {
+    double v;
+    if (!parse(p, end, v)) return false;
+    value = (T)v;
+    return true;
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value>::type
+  append_as(std::string& out, T value) { append(out, (long long)value); }
+
+  template<class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type
+  append_as(std::string& out, T value) { append(out, (double)value); }
+}
+
+/**
+ * Vector of ints or doubles taking the numeric fast path, stubgen uses it
+ * for std::vector<int>, std::vector<double> and friends when the spec sets
+ * "numeric_fastpath". The values travel as text in the attachment section
+ * of the frame (see AttachmentScope) instead of one json value each.
+ **/
+template<class T>
+class NumArray : public std::vector<T> {
+  static_assert(std::is_arithmetic<T>::value, "NumArray holds numbers only");
+
+  public:
+    using std::vector<T>::vector;
+
+    NumArray() {}
+    NumArray(const std::vector<T>& v) : std::vector<T>(v) {}
+    NumArray(std::vector<T>&& v) : std::vector<T>(std::move(v)) {}
+
+    void to_text(std::string& out) const {
+      out.reserve(out.size() + this->size() * (std::is_integral<T>::value ? 8 : 24));
+      for(size_t i = 0; i < this->size(); i ++) {
+        if (i != 0) out.push_back(',');
+        numeric::append_as(out, (*this)[i]);
+      }
+    }
+
+    bool from_text(const char* text, size_t len) {
+      size_t separators = 0;
+      this->clear();
+      // a null among reals fails the validation, parse checks every value
+      // anyway
+      bool valid = numeric::validate(text, len, std::is_floating_point<T>::value, separators);
+      if (!valid && !std::is_floating_point<T>::value) {
+        return false;
+      }
+
+      const char* p = text;
+      const char* end = text + len;
+      numeric::skip_space(p, end);
+      if (p == end) {
+        return true;
+      }
+
+      if (valid) {
+        this->reserve(separators + 1);
+      }
+      while (true) {
+        T value;
+        if (!numeric::parse_as(p, end, value)) {
+          return false;
+        }
+        this->push_back(value);
+
+        numeric::skip_space(p, end);
+        if (p == end) return true;
+        if (*p != ',') return false;
+        p ++;
+      }
+    }
+
+    void seralize(OutSerializer& serializer) {
+      AttachmentScope* scope = AttachmentScope::current();
+      if (scope == nullptr || !scope->writable()) {
+        throw SerializeFailException();
+      }
+
+      std::string& out = scope->buffer();
+      long offset = out.size();
+      to_text(out);
+      long len = out.size() - offset;
+      serializer & offset;
+      serializer & len;
+    }
+
+    void seralize(InSerializer& serializer) {
+      long offset = 0;
+      long len = 0;
+      serializer & offset;
+      serializer & len;
+
+      AttachmentScope* scope = AttachmentScope::current();
+      const char* text = nullptr;
+      if (scope != nullptr && offset >= 0 && len >= 0) {
+        text = scope->view(offset, len);
+      }
+      if (text == nullptr || !from_text(text, len)) {
+        throw SerializeFailException();
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef __JSONRPC_PODARRAY_HPP__
+#define __JSONRPC_PODARRAY_HPP__
+
+#include "json-rpc/bytes.hpp"
+#include "jconer/json.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+using namespace JCONER;
+
+/**
+ * Helpers for the fixed layout classes stubgen generates, see PodArray
+ **/
+namespace pod {
+  enum ByteOrder {
+    LITTLE_ENDIAN_ORDER = 1,
+    BIG_ENDIAN_ORDER = 2
+  };
+
+  inline int native_order() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return BIG_ENDIAN_ORDER;
+#else
+    return LITTLE_ENDIAN_ORDER;
+#endif
+  }
+
+  /* Reverse the bytes of a scalar in place */
+  template<class T>
+  typename std::enable_if<std::is_arithmetic<T>::value && sizeof(T) == 1>::type
+  byteswap(T& value) {}
+
+  template<class T>
+  typename std::enable_if<std::is_arithmetic<T>::value && sizeof(T) == 2>::type
+  byteswap(T& value) {
+    uint16_t v;
+    memcpy(&v, &value, 2);
+    v = __builtin_bswap16(v);
+    memcpy(&value, &v, 2);
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_arithmetic<T>::value && sizeof(T) == 4>::type
+  byteswap(T& value) {
+    uint32_t v;
+    memcpy(&v, &value, 4);
+    v = __builtin_bswap32(v);
+    memcpy(&value, &v, 4);
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_arithmetic<T>::value && sizeof(T) == 8>::type
+  byteswap(T& value) {
+    uint64_t v;
+    memcpy(&v, &value, 8);
+    v = __builtin_bswap64(v);
+    memcpy(&value, &v, 8);
+  }
+
+  template<class T, size_t N>
+  void byteswap(std::array<T, N>& value) {
+    for(size_t i = 0; i < N; i ++) {
+      byteswap(value[i]);
+    }
+  }
+}
+
+/**
+ * Vector of a fixed layout class, stubgen uses it for std::vector<T> of such
+ * classes when the spec sets "binary_pod". The elements go to the attachment
+ * section (see AttachmentScope) with one memcpy, the json only holds
+ * [offset, length, record size, byte order]. A receiver with the other byte
+ * order swaps every field after copying.
+ *
+ * T needs the byteswap() member stubgen generates for fixed layout classes.
+ **/
+template<class T>
+class PodArray : public std::vector<T> {
+  static_assert(std::is_trivially_copyable<T>::value, "PodArray holds fixed layout classes only");
+
+  public:
+    using std::vector<T>::vector;
+
+    PodArray() {}
+    PodArray(const std::vector<T>& v) : std::vector<T>(v) {}
+    PodArray(std::vector<T>&& v) : std::vector<T>(std::move(v)) {}
+
+    void seralize(OutSerializer& serializer) {
+      AttachmentScope* scope = AttachmentScope::current();
+      if (scope == nullptr || !scope->writable()) {
+        throw SerializeFailException();
+      }
+
+      long len = this->size() * sizeof(T);
+      long offset = scope->append((const char*)this->data(), len);
+      long record = sizeof(T);
+      long order = pod::native_order();
+      serializer & offset;
+      serializer & len;
+      serializer & record;
+      serializer & order;
+    }
+
+    void seralize(InSerializer& serializer) {
+      long offset = 0;
+      long len = 0;
+      long record = 0;
+      long order = 0;
+      serializer & offset;
+      serializer & len;
+      serializer & record;
+      serializer & order;
+
+      AttachmentScope* scope = AttachmentScope::current();
+      const char* data = nullptr;
+      if (scope != nullptr && offset >= 0 && len >= 0) {
+        data = scope->view(offset, len);
+      }
+      // a different record size means the two sides disagree on the layout
+      if (data == nullptr || record != (long)sizeof(T) || len % record != 0 ||
+          (order != pod::LITTLE_ENDIAN_ORDER && order != pod::BIG_ENDIAN_ORDER)) {
+        throw SerializeFailException();
+      }
+
+      this->resize(len / record);
+      if (len != 0) {
+        memcpy((void*)this->data(), data, len);
+      }
+      if (order != pod::native_order()) {
+        for(size_t i = 0; i < this->size(); i ++) {
+          (*this)[i].byteswap();
+        }
+      }
+    }
+};
+
+#endif
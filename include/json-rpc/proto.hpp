@@ -4,6 +4,8 @@
 #include <iostream>
 #include "jconer/json.hpp"
 #include "json-rpc/server/request.hpp"
+#include "json-rpc/bytes.hpp"
+#include "json-rpc/frame.hpp"
 
 using namespace JCONER;
 
@@ -16,6 +18,9 @@ static const std::string Method = "method";
 static const std::string Param  = "params";
 static const std::string Result = "result";
 static const std::string Error = "error";
+static const std::string Chunk = "chunk";
+static const std::string Upload = "upload";
+static const std::string End = "end";
 
 //error in connection
 static const int READ_FAIL = 5;
@@ -34,19 +39,34 @@ class Proto {
       PARAM_MISMATCH,
       BAD_MESSAGE,
       BAD_RESPONSE,
+      HANDLER_FAILED,
+      DEADLINE_EXCEEDED,
     };
 
 
     // server side protocol functions
     static Request build_request(std::string msg);
     static std::string build_response(Response& resp);
-    static std::string build_error(int code);
+    static void write_response(Response& resp, FrameBuffer& frame);
+    static std::string build_error(int code, int clientno = -1, int messageid = -1);
+    static void write_error(int code, FrameBuffer& frame, int clientno = -1, int messageid = -1);
+    static std::string build_chunk(OutSerializer& sout,
+                                   const std::string& attachments = std::string());
+    static std::string build_end();
+    static bool is_end(const std::string& frame);
+    /* clientno and messageid of a request or response without parsing
+     * it, false if they don't lead the message
+     */
+    static bool message_ids(const char* text, size_t len, int& clientno, int& messageid);
     // client side protolcol functions
-    static JValue* parse_response(std::string response);
+    static JValue* parse_response(std::string response, std::string* attachments = nullptr);
+    static void check_response(JValue* json_resp);
     static std::string build_request(
                          int clientno, int serverno,
                          int messageid, long timestamp,
-                         size_t method_hash, OutSerializer& sout);
+                         size_t method_hash, OutSerializer& sout,
+                         bool upload = false,
+                         const std::string& attachments = std::string());
 };
 
 #endif
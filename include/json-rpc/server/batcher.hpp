@@ -0,0 +1,155 @@
+#ifndef __JSONRPC_BATCHER_HPP__
+#define __JSONRPC_BATCHER_HPP__
+
+#include "json-rpc/server/request.hpp"
+#include "json-rpc/bytes.hpp"
+#include "json-rpc/errors.hpp"
+#include "jconer/json.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Gathers concurrent calls of a method marked "batchable" in the spec and
+ * runs them with one call of the batch handler (the generated fooBatch).
+ * The first call opens a batch and waits up to window_us for more, a batch
+ * reaching max_size runs right away, and so does one nobody else can join
+ * because the server connector has no request waiting for a worker (see
+ * ServerConnector::idle). Every call gets its own element of the returned
+ * vector, or the exception the handler threw.
+ *
+ * Only the first call keeps its worker thread. The ones joining are
+ * deferred (see Request::defer) and the first sends their responses once
+ * the batch ran. Over connectors that can't defer they wait in their
+ * worker thread.
+ **/
+template<class A, class R>
+class Batcher {
+  public:
+    typedef std::function<std::vector<R>(std::vector<A>&)> Handler;
+    typedef std::function<bool()> Idle;
+
+    Batcher(long window_us, size_t max_size, Handler handler, Idle idle = nullptr)
+        : _window(window_us), _max_size(max_size == 0 ? 1 : max_size),
+          _handler(handler), _idle(idle) {
+    }
+
+    /* Add the call of req to the open batch. True once the batch ran and
+     * result is the one of req, false if req joined a batch and was
+     * deferred, the batch sends its response then.
+     */
+    bool submit(Request& req, A args, R& result) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      bool leader = false;
+      if (!_open) {
+        _open.reset(new Batch());
+        leader = true;
+      }
+      std::shared_ptr<Batch> batch = _open;
+      size_t index = batch->calls.size();
+      batch->calls.push_back(std::move(args));
+      if (batch->calls.size() >= _max_size) {
+        // no one joins a full batch
+        _open.reset();
+        batch->full = true;
+      }
+
+      if (!leader) {
+        // wakes the first call, maybe nobody else is coming
+        _cond.notify_all();
+        if (req.can_defer() && !req.upload()) {
+          batch->deferred.push_back(std::make_pair(index, req.defer()));
+          return false;
+        }
+        _cond.wait(lock, [&] { return batch->done; });
+        result = _result(*batch, index);
+        return true;
+      }
+
+      _cond.wait_for(lock, _window, [&] { return batch->full || (_idle && _idle()); });
+      if (_open == batch) {
+        _open.reset();
+      }
+      lock.unlock();
+
+      std::vector<R> results;
+      std::exception_ptr error;
+      try {
+        results = _handler(batch->calls);
+        if (results.size() != batch->calls.size()) {
+          throw std::runtime_error("Batch handler returned " + std::to_string(results.size()) +
+                                   " results for " + std::to_string(batch->calls.size()) +
+                                   " calls");
+        }
+      } catch(...) {
+        error = std::current_exception();
+      }
+
+      lock.lock();
+      batch->results.swap(results);
+      batch->error = error;
+      batch->done = true;
+      _cond.notify_all();
+      lock.unlock();
+
+      // nobody adds to a batch that ran
+      for(auto it = batch->deferred.begin(); it != batch->deferred.end(); it ++) {
+        _complete(*batch, it->first, *it->second);
+      }
+      result = _result(*batch, index);
+      return true;
+    }
+
+  private:
+    struct Batch {
+      Batch() : full(false), done(false) {}
+      std::vector<A> calls;
+      std::vector<R> results;
+      std::exception_ptr error;
+      bool full;
+      bool done;
+      std::vector<std::pair<size_t, std::shared_ptr<Request> > > deferred;  // index of the call
+    };
+
+    std::chrono::microseconds _window;
+    size_t _max_size;
+    Handler _handler;
+    Idle _idle;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::shared_ptr<Batch> _open;  // the batch new calls join, if any
+
+    static R _result(Batch& batch, size_t index) {
+      if (batch.error) {
+        std::rethrow_exception(batch.error);
+      }
+      return batch.results[index];
+    }
+
+    /* Write the result of a deferred call and send it */
+    static void _complete(Batch& batch, size_t index, Request& req) {
+      std::exception_ptr error = batch.error;
+      if (!error) {
+        try {
+          AttachmentScope scope(&req.attachments(), &req.get_response().attachments());
+          JCONER::OutSerializer& sout = req.get_response().get_serializer();
+          sout & batch.results[index];
+        } catch(JCONER::SerializeFailException& e) {
+          error = std::make_exception_ptr(ServerParamMismatchException());
+        } catch(...) {
+          error = std::current_exception();
+        }
+      }
+      req.complete(error);
+    }
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __JSONRPC_COALESCER_HPP__
+#define __JSONRPC_COALESCER_HPP__
+
+#include "json-rpc/server/request.hpp"
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Lets concurrent requests of a method marked "coalesce" in the spec share
+ * one run of the method. The first request with a given params text (and
+ * raw section) runs it, the ones arriving meanwhile are deferred and get the
+ * result it encoded once it finished, without holding a worker thread.
+ * Nothing is kept after the run, see ResultCache for that.
+ *
+ * The generated wrapper holds a Flight for the request:
+ *
+ *   Coalescer::Flight __flight(_foo_coalescer, *req, [this](Request* r) { _foo_run(r); });
+ *   if (__flight.joined()) return;
+ *   _foo_run(req);
+ *   __flight.finish();
+ *
+ * If the run fails the next waiting request runs it through rerun, on the
+ * thread of the failed one. Requests of a connector that can't defer run on
+ * their own.
+ **/
+class Coalescer {
+  public:
+    typedef std::function<void(Request*)> Rerun;
+
+    class Flight {
+      public:
+        Flight(Coalescer& coalescer, Request& req, Rerun rerun);
+        ~Flight();
+
+        /* req was handed to another run, it answers it */
+        bool joined() const { return _joined; }
+
+        /* Send the result the method left in the response to the waiting
+         * requests
+         */
+        void finish();
+
+      private:
+        Coalescer& _coalescer;
+        Request& _req;
+        uint64_t _hash;
+        bool _joined;
+        bool _leader;
+        bool _finished;
+    };
+
+    Coalescer() {}
+
+    /* Requests waiting for a run of somebody else right now */
+    size_t waiting();
+
+  private:
+    struct Run {
+      size_t method;
+      std::string params;
+      std::string attachments;  // of the request
+      Rerun rerun;
+      std::vector<std::shared_ptr<Request> > waiters;
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<Run> > _runs;
+
+    void _end(uint64_t hash, Request& req, bool ok);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __JSONRPC_DEDUP_HPP__
+#define __JSONRPC_DEDUP_HPP__
+
+#include "json-rpc/server/request.hpp"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Remembers the responses to recent requests by (clientno, messageid), so a
+ * request the client sends again after a broken connection isn't run twice.
+ * The method, timestamp and a hash of the params have to match as well,
+ * otherwise it is a new request.
+ * A retry of an answered request gets the stored response. A retry of one
+ * still running is deferred and parked on its entry, finish sends it the
+ * response and abandon hands it back to be run again. Only retries that
+ * can't be deferred wait in their thread. Bounded by entry count and by
+ * age, see ServerConnector::enable_dedup.
+ **/
+class DedupTable {
+  public:
+    enum Claim {
+      RUN = 0,       // new request, run it and then call finish or abandon
+      ANSWERED = 1,  // retry, response holds the stored response
+      PARKED = 2     // retry of a running request, request was deferred
+    };
+
+    DedupTable(size_t capacity, long window_ms);
+
+    /* Claim a request. method, timestamp and params (Request::raw_hash)
+     * tell a retry apart from a new request of a client that happens to
+     * reuse the numbers. A retry of a running request is parked if request
+     * is given and can be deferred.
+     */
+    Claim claim(int clientno, int messageid, size_t method, long timestamp,
+                uint64_t params, std::string& response, Request* request = nullptr);
+
+    /* Store the response of a claimed request, send it to the parked
+     * retries and wake the waiting ones
+     */
+    void finish(int clientno, int messageid, size_t method, long timestamp,
+                uint64_t params, const char* response, size_t len);
+
+    /* Drop a claimed request that failed, waiting retries run it again.
+     * Returns the parked retries, the caller runs them.
+     */
+    std::vector<std::shared_ptr<Request> > abandon(int clientno, int messageid, size_t method,
+                                                   long timestamp, uint64_t params);
+
+    size_t size();
+
+  private:
+    typedef uint64_t Key;
+
+    struct Entry {
+      size_t method;
+      long timestamp;
+      uint64_t params;
+      uint64_t seq;        // tells entries of a reused key apart in _order
+      bool done;
+      uint64_t stored_at;  // ms, steady clock
+      std::shared_ptr<const std::string> response;
+      std::vector<std::shared_ptr<Request> > parked;
+      // retries waiting in their thread, shared as the entry may go first
+      std::shared_ptr<std::condition_variable> cond;
+    };
+
+    size_t _capacity;
+    long _window_ms;
+    uint64_t _seq;
+
+    std::mutex _mutex;
+    std::unordered_map<Key, Entry> _entries;
+    // oldest first, holds stale pairs of entries dropped meanwhile
+    std::deque<std::pair<Key, uint64_t> > _order;
+
+    static Key _key(int clientno, int messageid) {
+      return ((uint64_t)(uint32_t)clientno << 32) | (uint32_t)messageid;
+    }
+
+    static uint64_t _now_ms();
+    Entry* _find(int clientno, int messageid, size_t method, long timestamp,
+                 uint64_t params);
+    void _evict(uint64_t now);
+};
+
+#endif
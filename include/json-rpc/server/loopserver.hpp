@@ -0,0 +1,88 @@
+#ifndef __JSONRPC_LOOPSERVER_HPP__
+#define __JSONRPC_LOOPSERVER_HPP__
+
+#include "json-rpc/server/sconn.hpp"
+#include "json-rpc/server/request.hpp"
+#include "json-rpc/proto.hpp"
+#include "json-rpc/errors.hpp"
+
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Server connector for a service living in the same process as its clients.
+ * Nothing listens, LoopbackClient hands requests to the service directly.
+ **/
+class LoopbackServer : public ServerConnector {
+  public:
+    LoopbackServer() : ServerConnector() {}
+
+    int start() { return 0; }
+    int stop() { return 0; }
+
+    /* Serve a request message and return the response message, frames of
+     * a streamed response go to sink first. Chunks of an uploaded argument
+     * are pulled from source.
+     */
+    std::string serve(const std::string& msg, FrameSink sink = nullptr,
+                      FrameSource source = nullptr) {
+      return _serve(msg, sink, source);
+    }
+
+    /* Serve a request without any text in between. The request takes over
+     * params, the returned response object belongs to the caller. Raw
+     * sections are passed through as they are.
+     */
+    JValue* serve(int clientno, int messageid, long timestamp,
+                  size_t method_hash, JValue* params,
+                  const std::string& attachments, std::string& resp_attachments) {
+      JObject* obj = new JObject();
+      try {
+        Request request(clientno, 0, 1, timestamp, messageid, method_hash, params, params);
+        request.set_attachments(attachments);
+
+        // a deferred response is waited for, the caller is blocked anyway
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool done = false;
+        request.set_completion([&](Request& req, std::exception_ptr error) {
+          std::lock_guard<std::mutex> _(mutex);
+          if (error) {
+            obj->put(Error, _error_code(error));
+          } else {
+            obj->put(Result, req.get_response().get_serializer().getContent());
+            resp_attachments.swap(req.get_response().attachments());
+          }
+          done = true;
+          cond.notify_one();
+        });
+
+        bool ready = false;
+        try {
+          if (_handler->on_request(&request) == 0) {
+            throw ServerMethodNotFoundException();
+          }
+          ready = !request.deferred();
+        } catch(...) {
+          if (!request.deferred()) {
+            throw;
+          }
+          LOG(INFO) << "Handler failed after deferring message " << messageid << std::endl;
+        }
+
+        if (ready) {
+          obj->put(Result, request.get_response().get_serializer().getContent());
+          resp_attachments.swap(request.get_response().attachments());
+        } else {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(lock, [&done] { return done; });
+        }
+      } catch(ServerException& e) {
+        LOG(DEBUG) << e.what() << std::endl;
+        obj->put(Error, e.get_code());
+      }
+      return obj;
+    }
+};
+
+#endif
@@ -3,10 +3,14 @@
 
 #include "json-rpc/util.hpp"
 #include "json-rpc/buffer.hpp"
+#include "json-rpc/frame.hpp"
 #include "json-rpc/server/sconn.hpp"
 #include "json-rpc/server/request.hpp"
 #include "json-rpc/server/asio.hpp"
 #include "json-rpc/errors.hpp"
+#include "json-rpc/trace.hpp"
+#include "json-rpc/mpscqueue.hpp"
+#include "json-rpc/timerwheel.hpp"
 #include "common/all.hpp"
 
 #include <sys/types.h>
@@ -17,7 +21,14 @@
 #include <unistd.h>
 
 #include <list>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 enum class FD_MODE {
   READ = 0,
@@ -33,7 +44,15 @@ class PollManager {
     void watch(int fd, FD_MODE mod);
     void unwatch(int fd, FD_MODE mod);
 
-    bool poll(std::vector<int>& read_fds, std::vector<int>& write_fds);
+    /* watch for many fds under one lock, they have to be nonblocking
+     * already
+     */
+    void watch_all(const std::vector<int>& fds, FD_MODE mod);
+
+    /* Wait until some fds are ready or timeout_ms passed, -1 waits for
+     * fds only
+     */
+    bool poll(std::vector<int>& read_fds, std::vector<int>& write_fds, long timeout_ms = -1);
   private:
     int _highest;
     fd_set _read_set;
@@ -53,18 +72,119 @@ class Channel;
 class PollServer : public ServerConnector {
   public:
     PollServer(std::string port);
+    PollServer(UnixPath path);
 
     int start();
     int stop();
 
     void loop();
 
+    /* Close connections that had nothing to read or write and no request
+     * in flight for idle_ms. 0, the default, keeps them open.
+     * Has to be set before start, like the other timeouts.
+     */
+    void set_idle_timeout(long idle_ms) { _idle_timeout = idle_ms; }
+
+    /* Close connections whose responses went out no further for stall_ms,
+     * a client that stopped reading. 0 turns it off.
+     */
+    void set_write_timeout(long stall_ms) { _write_timeout = stall_ms; }
+
+    /* Answer requests that got no response within deadline_ms with
+     * DEADLINE_EXCEEDED and drop the response coming later. The handler
+     * isn't stopped. 0 turns it off.
+     */
+    void set_request_timeout(long deadline_ms) { _request_timeout = deadline_ms; }
+
+    /* Run fn on a worker thread once delay_ms passed, from any thread.
+     * Tasks still waiting when the server goes away don't run.
+     */
+    void schedule(long delay_ms, std::function<void()> fn);
+
+    /* Runs jobs on the worker pool, e.g. for MuxClient::set_executor so
+     * handlers awaiting another service resume on a worker
+     */
+    std::function<void(std::function<void()>)> executor();
+
+    /* Connections accepted, connections refused because the process ran
+     * out of fds or select can't take them, and times the accept queue of
+     * the listening socket was found full (tcp only)
+     */
+    uint64_t accepted() const { return _accepted; }
+    uint64_t rejected() const { return _rejected; }
+    uint64_t backlog_overflows() const { return _backlog_overflows; }
+
+    /* No request waits for the pool, see ServerConnector::idle */
+    bool idle() const { return _queued == 0; }
+
     virtual ~PollServer();
 
   private:
-    ThreadPool _thread_pool;
-    bool _stop;
+    // a pointer so the destructor can join the workers before anything
+    // they post to goes away
+    std::unique_ptr<ThreadPool> _thread_pool;
+    std::atomic<int> _queued;   // requests handed to the pool, not started yet
+    std::atomic<bool> _stop;   // posts are dropped from here on
     std::map<int, Channel*> _channels;
+    uint64_t _next_channel_id;
+
+    /* What workers hand to the reactor, which alone touches the sockets */
+    struct Outgoing {
+      enum Kind {
+        FRAME = 0,
+        LAST_FRAME = 1,   // the response or error ending a request
+        RESUME_READ = 2,  // read the socket again after an upload paused it
+        TASK = 3          // see schedule
+      };
+
+      Outgoing()
+          : kind(FRAME), sock(-1), channel(0), request(0), frame(nullptr),
+            trace_id(0), posted_at(0), delay_ms(0) {
+      }
+
+      Kind kind;
+      int sock;
+      uint64_t channel;     // Channel::id, the socket may be reused meanwhile
+      uint64_t request;     // Channel::request of the request answered
+      FrameBuffer* frame;
+      uint64_t trace_id;
+      uint64_t posted_at;   // set if traced
+      long delay_ms;
+      std::function<void()> task;
+    };
+
+    /* Filled by workers, drained by the reactor once _wake_fd fires.
+     * _wake_pending saves the eventfd write while the reactor has a
+     * wakeup coming anyway.
+     */
+    MpscQueue<Outgoing> _outgoing;
+    int _wake_fd;
+    std::atomic<bool> _wake_pending;
+
+    /* Reactor side of the timeouts and scheduled tasks */
+    long _idle_timeout;
+    long _write_timeout;
+    long _request_timeout;
+    TimerWheel _wheel;
+    uint64_t _now;            // ms, refreshed every loop pass
+    uint64_t _next_request;
+
+    /* A request waiting for its response, while request timeouts are on */
+    struct Deadline {
+      TimerWheel::TimerId timer;
+      int sock;
+      uint64_t channel;
+      int clientno;
+      int messageid;
+    };
+    std::unordered_map<uint64_t, Deadline> _deadlines;
+
+    /* Accepting, by the reactor */
+    int _spare_fd;            // given up to turn a connection away once fds ran out
+    std::atomic<uint64_t> _accepted;
+    std::atomic<uint64_t> _rejected;
+    std::atomic<uint64_t> _backlog_overflows;
+    uint64_t _overflow_logged_at;
 
     class ServerLoopThread : public Thread {
       public:
@@ -79,11 +199,42 @@ class PollServer : public ServerConnector {
     };
 
     friend class ServerLoopThread;
+    friend class Channel;
     ServerLoopThread _thread;
 
     void _close_channels();
     void _add_job_wrapper(Channel* chan);
     void _handle_request(Channel*);
+
+    /* Reactor: take what waits in the accept queue, up to a cap */
+    void _accept();
+    void _refuse(const char* why);
+    bool _backlog_full();
+
+    /* Any thread: queue frame for the channel and wake the reactor */
+    void _post(int sock, uint64_t channel, uint64_t request, FrameBuffer* frame,
+               uint64_t trace_id, bool last);
+    void _post(int sock, uint64_t channel, uint64_t request, const std::string& msg,
+               uint64_t trace_id, bool last);
+    void _post(Outgoing& out);
+    void _post_resume(int sock, uint64_t channel);
+    void _wake();
+
+    /* Reactor: move what workers posted onto the channels and write them */
+    void _drain_outgoing();
+    Channel* _find(int sock, uint64_t channel);
+    void _write(Channel* chan);
+    void _drop_channel(int sock);
+    void _run_task(std::function<void()> task);
+
+    /* Reactor: timers, they find their channel by socket and id as well */
+    void _watch_idle(int sock, uint64_t channel);
+    void _watch_stall(int sock, uint64_t channel);
+    void _check_idle(int sock, uint64_t channel);
+    void _check_stall(int sock, uint64_t channel);
+    void _start_deadline(Channel* chan, uint64_t request);
+    bool _answered(uint64_t request);
+    void _expire(uint64_t request);
 };
 
 class Channel {
@@ -97,37 +248,122 @@ class Channel {
       WRITE_READY = 4,    // when chanell finishes writing
     };
 
-    Channel(int sock, PollServer* server);
+    Channel(int sock, uint64_t id, PollServer* server);
     virtual ~Channel();
 
+    int sock() const { return _sock; }
+    uint64_t id() const { return _id; }
+
+    /* The request handed to a worker last, numbered by the reactor */
+    uint64_t request() const { return _request; }
+    void set_request(uint64_t request) { _request = request; }
+
+    /* clientno and messageid of the message read, -1 if they can't be told */
+    void message_ids(int& clientno, int& messageid);
+
+    /* Reactor bookkeeping for the timeouts, see PollServer */
+    struct Timers {
+      uint64_t last_active;     // ms of the last read or write progress
+      uint64_t last_write;      // ms the first frame waiting was written to last
+      TimerWheel::TimerId idle;
+      TimerWheel::TimerId stall;
+      int in_flight;            // requests handed to workers, not answered
+    };
+    Timers& timers() { return _timers; }
+
+    /* Bytes written so far, and whether some are left. Reactor only. */
+    uint64_t written() const { return _written; }
+    bool writing() const { return !_out.empty(); }
+
     State read();   // read callback
-    State write();  // write callback
+    /* Write what is queued, as much as the socket takes. The socket is
+     * watched for writing while some is left. Reactor only.
+     */
+    State write();
 
-    void send(std::string msg);
-    void send(const char* msg, size_t len);
+    /* Queue a finished frame to go out as is, the channel gives it back to
+     * the FramePool once it is written. Returns true if nothing was queued
+     * before. Reactor only, workers go through PollServer::_post.
+     */
+    bool queue(FrameBuffer* frame, uint64_t trace_id = 0);
 
     void close();
 
     bool is_alive();
 
+    /* Reactor hands the message read to a worker and stops reading the
+     * socket until the worker took it, the next request may follow right
+     * away
+     */
+    void hold();
     std::string get_msg(); // result the message channel got from client
-    void clear_msg(); // clear write only buffer and send a read notification
+    /* Worker took the message, the reactor reads on once it gets the
+     * resume posted here. Returns true if the reactor let go of the
+     * channel meanwhile, and the caller has to delete it.
+     */
+    bool clear_msg();
+
+    /* While a handler reads an uploaded argument, the frames following the
+     * request are queued for it instead of being handled as new requests.
+     * The reactor stops reading the socket while the queue is full.
+     */
+    void start_upload();
+    bool uploading();
+    void push_frame();                  // reactor side, takes the message read
+    bool next_frame(std::string& frame); // handler side, false if closed
+    /* Handler is done with the upload. Returns true if the reactor let go
+     * of the channel meanwhile, and the caller has to delete it
+     */
+    bool finish_upload();
+    /* Reactor lets go of the channel. Returns false if a worker still
+     * holds the message or is inside an upload, which then deletes the
+     * channel
+     */
+    bool release();
+
+    /* Reactor side of a resume posted by the worker, unless the message is
+     * still held or the upload queue filled up again meanwhile
+     */
+    void resume_read();
+
+    /* Trace id of the message being read or handled, 0 if not sampled */
+    uint64_t trace_id() const { return _trace_id; }
+    uint64_t queued_at() const { return _queued_at; }
+    void mark_queued() { if (_trace_id) _queued_at = Tracer::now(); }
 
   private:
     int _sock;
+    uint64_t _id;
+    PollServer* _server;
+
+    uint64_t _trace_id;
+    uint64_t _queued_at;
 
-    SizedRDONBuffer *_read_buffer;
+    struct OutFrame {
+      FrameBuffer* frame;
+      uint64_t trace_id;
+      uint64_t start;
+    };
+
+    std::deque<OutFrame> _out; // frames to write, reactor only
+    size_t _out_pos;           // bytes of the first one already written
+    uint64_t _written;
+    bool _write_watched;
+    bool _open;                // reactor's copy of _alive, without the lock
+    uint64_t _request;
+    Timers _timers;
     SizedWRONBuffer *_write_buffer;
 
-    Mutex _send_mutex;
-    Mutex _read_mutex;
-    Condition _read_cond;
-    bool _alive;
+    bool _alive;          // guarded by _upload_mutex
 
-    /* When channel finishes reading one message, it has to handle the message.
-     * Now set busy to be true and blocking any other read callback
-     */
-    bool _busy;
+    std::mutex _upload_mutex;
+    bool _held;           // a worker has the message, the socket is unwatched
+    std::condition_variable _upload_cond;
+    std::deque<std::string> _upload_frames;
+    bool _uploading;      // frames go to the upload queue
+    bool _upload_owner;   // a handler is reading the upload
+    bool _upload_paused;  // socket unwatched, the queue is full
+    bool _orphaned;       // reactor dropped the channel while a worker had it
 };
 
 #endif
@@ -2,19 +2,97 @@
 #define __JSONRPC_REQUEST_HPP__
 
 #include "jconer/json.hpp"
+#include <stdint.h>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
 using namespace JCONER;
 
+/**
+ * Sends one frame to the client ahead of the response, set up by the server
+ * connector
+ **/
+typedef std::function<void(const std::string&)> FrameSink;
+
+/**
+ * Fetches the next frame the client sent after the request, set up by the
+ * server connector. Returns false if the connection is gone.
+ **/
+typedef std::function<bool(std::string&)> FrameSource;
+
+class Request;
+
+/**
+ * Writes and sends the response of a request its handler deferred, set up
+ * by the server connector. error is what the handler failed with, if it
+ * did.
+ **/
+typedef std::function<void(Request&, std::exception_ptr)> Completion;
+
 /**
  * Response contains a out serializer that holds the message to client
  **/
 class Response {
   public:
-    Response() {};
+    Response() : _streamed(false), _clientno(-1), _messageid(-1) {};
 
     OutSerializer& get_serializer() { return _sout; }
 
+    /* Raw section following the json text, see AttachmentScope */
+    std::string& attachments() { return _attachments; }
+
+    void set_sink(FrameSink sink) { _sink = sink; }
+    const FrameSink& sink() const { return _sink; }
+
+    void send_frame(const std::string& frame) {
+      if (!_sink) {
+        throw std::runtime_error("Server connector doesn't support streaming");
+      }
+      _streamed = true;
+      _sink(frame);
+    }
+
+    /* The request the response answers, echoed in the response so a
+     * client with several requests in flight can tell them apart. -1 if
+     * unknown.
+     */
+    void set_ids(int clientno, int messageid) {
+      _clientno = clientno;
+      _messageid = messageid;
+    }
+    int clientno() const { return _clientno; }
+    int messageid() const { return _messageid; }
+
+    /* Frames went out ahead of the response */
+    bool streamed() const { return _streamed; }
+
+    /* Send text, already encoded, as the result instead of what the
+     * serializer holds, see ResultCache
+     */
+    void set_raw_result(std::shared_ptr<const std::string> text) { _raw_result = text; }
+    const std::string* raw_result() const { return _raw_result.get(); }
+
+    /* Encode what the serializer holds into the raw result, unless there is
+     * one already, and return it
+     */
+    std::shared_ptr<const std::string> encode_result();
+
+    /* Send text as the whole response, raw section included, e.g. the
+     * stored response of a retried request (see DedupTable)
+     */
+    void set_raw_frame(std::shared_ptr<const std::string> text) { _raw_frame = text; }
+    const std::string* raw_frame() const { return _raw_frame.get(); }
+
   private:
     OutSerializer _sout;
+    std::string _attachments;
+    FrameSink _sink;
+    bool _streamed;
+    std::shared_ptr<const std::string> _raw_result;
+    std::shared_ptr<const std::string> _raw_frame;
+    int _clientno;
+    int _messageid;
 };
 
 /**
@@ -33,6 +111,27 @@ class Request {
     InSerializer& get_serializer() { return _sin; }
     Response& get_response() { return _resp;}
 
+    /* Raw section following the json text, see AttachmentScope */
+    const std::string& attachments() { return _attachments; }
+    void set_attachments(std::string attachments) { _attachments = std::move(attachments); }
+
+    /* The params array as the client wrote it, empty if the request didn't
+     * come as text. msg is the whole request message.
+     */
+    void set_raw(std::string msg, size_t params_offset, size_t params_len) {
+      _raw = std::move(msg);
+      _params_offset = params_offset;
+      _params_len = params_len;
+      _raw_hash = 0;
+    }
+    const char* raw_params() const { return _raw.data() + _params_offset; }
+    size_t raw_params_size() const { return _params_len; }
+
+    /* FNV-1a over the method id, the raw params and the raw section,
+     * computed once
+     */
+    uint64_t raw_hash();
+
     inline int clientno() { return _clientno; }
     inline int serverno() { return _serverno; }
     inline long timestamp() { return _timestamp; }
@@ -40,6 +139,44 @@ class Request {
     inline int messageid() { return _messageid; }
     inline size_t handlerid() { return _handlerid; }
 
+    /* An uploaded argument follows the request as chunk frames */
+    inline bool upload() { return _upload; }
+    void set_upload(bool upload) { _upload = upload; }
+    void set_source(FrameSource source) { _source = source; }
+
+    /* Next chunk of the uploaded argument, nullptr after the last one. The
+     * caller deletes the returned chunk frame. Its raw section goes to
+     * attachments.
+     */
+    JValue* next_chunk(std::string* attachments = nullptr);
+
+    /* Skip the chunks the handler didn't read, so the next frame on the
+     * connection is a request again
+     */
+    void drain_upload();
+
+    /* Connectors that can send a response after the handler returned set
+     * its completion, on_defer runs when a handler defers
+     */
+    void set_completion(Completion completion, std::function<void()> on_defer = nullptr) {
+      _completion = completion;
+      _on_defer = on_defer;
+    }
+    bool can_defer() const { return (bool)_completion; }
+
+    /* Take the request over from the connector, which then sends nothing
+     * when the handler returns. The response goes out once complete is
+     * called on the returned request, from any thread. Throws if the
+     * connector can't do that or the request has an uploaded argument.
+     */
+    std::shared_ptr<Request> defer();
+    bool deferred() const { return _deferred; }
+
+    /* Send the response of a deferred request, or the error for what the
+     * handler failed with
+     */
+    void complete(std::exception_ptr error = nullptr);
+
   private:
     
     // information of message
@@ -52,8 +189,22 @@ class Request {
 
     InSerializer _sin;
     JValue* _msg_json;
+    std::string _attachments;
     Response _resp;
 
+    std::string _raw;
+    size_t _params_offset;
+    size_t _params_len;
+    uint64_t _raw_hash;   // 0 until raw_hash computed it
+
+    bool _upload;
+    bool _upload_done;
+    FrameSource _source;
+
+    Completion _completion;
+    std::function<void()> _on_defer;
+    bool _deferred;       // moved to the request defer returned
+
 };
 
 #endif
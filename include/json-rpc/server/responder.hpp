@@ -0,0 +1,122 @@
+#ifndef __JSONRPC_RESPONDER_HPP__
+#define __JSONRPC_RESPONDER_HPP__
+
+#include "json-rpc/server/request.hpp"
+#include "json-rpc/errors.hpp"
+#include "json-rpc/bytes.hpp"
+#include "jconer/json.hpp"
+
+#include <exception>
+#include <memory>
+#include <mutex>
+
+namespace responder_detail {
+
+/* The deferred request all copies of a Responder share */
+struct State {
+  State(std::shared_ptr<Request> req) : request(req), answered(false) {}
+
+  ~State() {
+    if (!answered) {
+      LOG(INFO) << "Deferred request " << request->messageid() << " was never answered"
+                << std::endl;
+      request->complete(std::make_exception_ptr(ServerHandlerFailedException()));
+    }
+  }
+
+  /* Claim the answer, false if a copy answered already. mutex is held. */
+  bool claim() {
+    if (answered) {
+      return false;
+    }
+    answered = true;
+    return true;
+  }
+
+  void fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> _(mutex);
+    if (claim()) {
+      request->complete(error);
+    }
+  }
+
+  std::shared_ptr<Request> request;
+  std::mutex mutex;
+  bool answered;
+};
+
+}
+
+/**
+ * Answers a request after its handler returned, from any thread, a timer or
+ * a callback. Making one takes the request over from the server connector
+ * (see Request::defer), which sends the response once reply or fail is
+ * called. Methods marked "deferred" in the spec get one as their last
+ * argument.
+ *
+ * Copies answer the same request and the first answer counts. If the last
+ * copy goes away unanswered the client gets a HANDLER_FAILED error.
+ * Answers after the server was stopped are dropped, but every copy has to
+ * be answered or gone before the server is destroyed.
+ **/
+template<class R>
+class Responder {
+  public:
+    explicit Responder(Request& req) : _state(new responder_detail::State(req.defer())) {}
+
+    /* Send result as the response */
+    void reply(R result) {
+      std::lock_guard<std::mutex> _(_state->mutex);
+      if (!_state->claim()) {
+        return;
+      }
+
+      Request& req = *_state->request;
+      std::exception_ptr error;
+      try {
+        AttachmentScope scope(&req.attachments(), &req.get_response().attachments());
+        OutSerializer& sout = req.get_response().get_serializer();
+        sout & result;
+      } catch(SerializeFailException& e) {
+        error = std::make_exception_ptr(ServerParamMismatchException());
+      }
+      req.complete(error);
+    }
+
+    /* Send the error for error instead, a ServerException keeps its code */
+    void fail(std::exception_ptr error) {
+      _state->fail(error);
+    }
+
+    bool answered() {
+      std::lock_guard<std::mutex> _(_state->mutex);
+      return _state->answered;
+    }
+
+  private:
+    std::shared_ptr<responder_detail::State> _state;
+};
+
+template<>
+class Responder<void> {
+  public:
+    explicit Responder(Request& req) : _state(new responder_detail::State(req.defer())) {}
+
+    void reply() {
+      _state->fail(nullptr);
+    }
+
+    void fail(std::exception_ptr error) {
+      _state->fail(error);
+    }
+
+    bool answered() {
+      std::lock_guard<std::mutex> _(_state->mutex);
+      return _state->answered;
+    }
+
+  private:
+    std::shared_ptr<responder_detail::State> _state;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef __JSONRPC_RESULTCACHE_HPP__
+#define __JSONRPC_RESULTCACHE_HPP__
+
+#include "json-rpc/server/request.hpp"
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Results of a method marked "cache" in the spec, keyed by the method id and
+ * the raw params text (with the raw section) of the request. A hit hands
+ * the stored result text to the response as it is, so the arguments aren't
+ * decoded, the method doesn't run and the result isn't encoded again.
+ *
+ * Entries expire ttl_ms after they were stored, each shard drops its least
+ * recently used entry when full. Requests the server didn't get as text
+ * (LoopbackServer without a text round trip) bypass the cache.
+ **/
+class ResultCache {
+  public:
+    static const size_t MAX_SHARDS = 16;
+
+    /* Identifies the request between lookup and store */
+    struct Key {
+      Key() : hash(0), valid(false) {}
+      uint64_t hash;
+      bool valid;
+    };
+
+    ResultCache(long ttl_ms, size_t max_entries);
+
+    /* Answer req from the cache, true on a hit. Fills key for store on a
+     * miss.
+     */
+    bool lookup(Request& req, Key& key);
+
+    /* Keep the result the method left in the response of req, which then
+     * sends the stored text as well
+     */
+    void store(const Key& key, Request& req);
+
+    size_t size();
+    void clear();
+
+  private:
+    struct Result {
+      std::shared_ptr<const std::string> text;
+      std::string attachments;
+    };
+
+    struct Entry {
+      uint64_t hash;
+      size_t method;
+      std::string params;       // compared on lookup, hashes may collide
+      std::string attachments;  // of the request
+      uint64_t expires_at;      // ms, steady clock
+      std::shared_ptr<const Result> result;
+    };
+
+    struct Shard {
+      std::mutex mutex;
+      std::list<Entry> lru;  // most recently used first
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    long _ttl_ms;
+    size_t _shard_capacity;
+    std::vector<std::unique_ptr<Shard> > _shards;
+
+    Shard& _shard(uint64_t hash) { return *_shards[hash % _shards.size()]; }
+
+    static uint64_t _now_ms();
+};
+
+#endif
@@ -2,16 +2,21 @@
 #define __JSONRPC_SCONN_HPP__
 
 #include "json-rpc/server/asio.hpp"
+#include "json-rpc/server/dedup.hpp"
 #include "json-rpc/errors.hpp"
 #include "json-rpc/util.hpp"
+#include "json-rpc/sockopt.hpp"
+#include "json-rpc/trace.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
-static const int MAX_QUEUE_SIZE = 100;
+#include <condition_variable>
+#include <mutex>
 
 /**
  * A basic server connector that will be inherited by other solid server
@@ -20,7 +25,7 @@ static const int MAX_QUEUE_SIZE = 100;
 class ServerConnector {
   public:
     ServerConnector(std::string port)
-        : _handler(nullptr), _host_info(nullptr), _sock(UNINIT_SOCKET){
+        : _handler(nullptr), _host_info(nullptr), _sock(UNINIT_SOCKET), _dedup(nullptr) {
       struct addrinfo hints;
       memset(&hints, 0, sizeof(struct addrinfo));
       hints.ai_family = AF_INET;
@@ -33,8 +38,25 @@ class ServerConnector {
       }
     }
 
+    ServerConnector(UnixPath path)
+        : _handler(nullptr), _host_info(nullptr), _sock(UNINIT_SOCKET),
+          _unix_path(path.path), _dedup(nullptr) {
+      struct sockaddr_un addr;
+      if (!unix_addr(_unix_path, addr)) {
+        throw HostFailException("Unix socket path too long", "unix", _unix_path);
+      }
+    }
+
     virtual ~ServerConnector() {
-      freeaddrinfo(_host_info);
+      if (_host_info) {
+        freeaddrinfo(_host_info);
+      }
+      if (_sock != UNINIT_SOCKET && !_unix_path.empty()) {
+        unlink(_unix_path.c_str());
+      }
+      if (_dedup) {
+        delete _dedup;
+      }
     }
 
     virtual int start() = 0;
@@ -44,17 +66,61 @@ class ServerConnector {
       _handler = handler;
       return 0;
     }
+
+    /* Has to be set before start */
+    void set_socket_options(const SocketOptions& options) {
+      _options = options;
+    }
+
+    const SocketOptions& socket_options() const { return _options; }
+
+    /* Answer a request the client sends again (same clientno, messageid,
+     * method and timestamp) with the response of the first one instead of
+     * running it twice, a retry arriving while the first still runs waits
+     * for it. Responses are kept for window_ms, at most capacity of them.
+     * Uploads and streamed responses are never stored.
+     * Has to be set before start.
+     */
+    void enable_dedup(size_t capacity = 4096, long window_ms = 30000) {
+      if (_dedup) {
+        delete _dedup;
+      }
+      _dedup = new DedupTable(capacity, window_ms);
+    }
+
+    /* No request is waiting for a worker thread right now, so a batch
+     * gets no more calls by waiting. Connectors that can't tell say no.
+     */
+    virtual bool idle() const { return false; }
+
+    /* Address family of the listening socket */
+    int family() const {
+      return _host_info ? _host_info->ai_family : AF_UNIX;
+    }
   
   protected:
+    /* For connectors that don't listen on a socket
+     */
+    ServerConnector()
+        : _handler(nullptr), _host_info(nullptr), _sock(UNINIT_SOCKET), _dedup(nullptr) {
+    }
+
     ASIO* _handler;
     struct addrinfo* _host_info;
     int _sock;
+    std::string _unix_path; // empty unless listening on a unix domain socket
+    SocketOptions _options;
+    DedupTable* _dedup; // nullptr unless enable_dedup was called
 
     int _listen() {
       if (_sock != UNINIT_SOCKET)  {
         return -1;
       }
 
+      if (!_unix_path.empty()) {
+        return _listen_unix();
+      }
+
       _sock = ::socket(_host_info->ai_family, _host_info->ai_socktype, _host_info->ai_protocol);
       if (_sock == UNINIT_SOCKET) {
         throw SocketFailException("socket");
@@ -62,13 +128,297 @@ class ServerConnector {
 
       int optval = 1;
       setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+      _options.apply_listener(_sock, _host_info->ai_family);
 
       int r = bind(_sock, _host_info->ai_addr, _host_info->ai_addrlen);
       if (r != 0) {
         throw SocketFailException("bind");
       }
 
-      r = ::listen(_sock, MAX_QUEUE_SIZE);
+      r = ::listen(_sock, _options.backlog);
+      if (r != 0) {
+        throw SocketFailException("listen");
+      }
+      return 0;
+    }
+
+    /* Build a request out of msg, hand it to the registered service and
+     * return the text to send back, which is an error message if anything
+     * goes wrong. Frames of a streamed response go to sink.
+     */
+    std::string _serve(const std::string& msg, FrameSink sink = nullptr,
+                       FrameSource source = nullptr) {
+      int clientno = -1;
+      int messageid = -1;
+      try {
+        if (msg == "") {
+          throw ServerBadMessageException();
+        }
+
+        Request request = Proto::build_request(msg);
+        clientno = request.clientno();
+        messageid = request.messageid();
+        request.get_response().set_sink(sink);
+        request.set_source(source);
+        FrameBuffer frame;
+        _respond_wait(request, frame);
+        return std::string(frame.payload(), frame.payload_size());
+      } catch(ServerException& e) {
+        LOG(DEBUG) << e.what() << std::endl;
+        return Proto::build_error(e.get_code(), clientno, messageid);
+      }
+    }
+
+    /* Run request and write its response into frame, or the stored response
+     * if it is a retry, see enable_dedup. False if the handler deferred the
+     * response, the completion of the request writes it later.
+     */
+    bool _respond(Request& request, FrameBuffer& frame, uint64_t trace_id = 0) {
+      if (_dedup == nullptr || request.upload()) {
+        if (!_run(request, trace_id)) {
+          return false;
+        }
+        TraceScope span("Proto::write_response", trace_id);
+        Proto::write_response(request.get_response(), frame);
+        return true;
+      }
+
+      std::string stored;
+      switch (_dedup->claim(request.clientno(), request.messageid(), request.handlerid(),
+                            request.timestamp(), request.raw_hash(), stored, &request)) {
+        case DedupTable::ANSWERED:
+          LOG(DEBUG) << "Answer retried message " << request.messageid() << " of client "
+                     << request.clientno() << std::endl;
+          frame.clear();
+          frame.append(stored);
+          frame.finish();
+          return true;
+        case DedupTable::PARKED:
+          // answered when the running copy finishes
+          return false;
+        case DedupTable::RUN:
+          break;
+      }
+
+      try {
+        if (!_run(request, trace_id)) {
+          // the entry is settled once the response is written
+          return false;
+        }
+        TraceScope span("Proto::write_response", trace_id);
+        Proto::write_response(request.get_response(), frame);
+      } catch(...) {
+        // failures aren't stored, a retry runs the request again
+        _abandon(request);
+        throw;
+      }
+
+      _settle(request, frame, true);
+      return true;
+    }
+
+    /* _respond for connectors serving each connection from a thread of
+     * its own. A deferred response is waited for, the client doesn't send
+     * anything else meanwhile anyway.
+     */
+    void _respond_wait(Request& request, FrameBuffer& frame) {
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool done = false;
+      request.set_completion([&](Request& req, std::exception_ptr error) {
+        std::lock_guard<std::mutex> _(mutex);
+        _complete(req, frame, error);
+        done = true;
+        cond.notify_one();
+      });
+
+      if (!_respond(request, frame)) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&done] { return done; });
+      }
+    }
+
+    /* Run the handler of request, false if it deferred the response. The
+     * deferred request belongs to whoever answers it, so what the handler
+     * throws after deferring is only logged.
+     */
+    bool _run(Request& request, uint64_t trace_id) {
+      TraceScope span("handler", trace_id);
+      try {
+        _dispatch(request);
+      } catch(...) {
+        if (!request.deferred()) {
+          throw;
+        }
+        LOG(INFO) << "Handler failed after deferring message " << request.messageid()
+                  << std::endl;
+      }
+      return !request.deferred();
+    }
+
+    /* The error code for what the handler of a deferred request failed
+     * with
+     */
+    static int _error_code(std::exception_ptr error) {
+      try {
+        std::rethrow_exception(error);
+      } catch(ServerException& e) {
+        LOG(DEBUG) << e.what() << std::endl;
+        return e.get_code();
+      } catch(SerializeFailException& e) {
+        return Proto::PARAM_MISMATCH;
+      } catch(std::exception& e) {
+        LOG(INFO) << "Deferred handler failed: " << e.what() << std::endl;
+      } catch(...) {
+        LOG(INFO) << "Deferred handler failed" << std::endl;
+      }
+      return Proto::HANDLER_FAILED;
+    }
+
+    /* Write the response of a deferred request into frame, or the error
+     * for what its handler failed with
+     */
+    void _complete(Request& request, FrameBuffer& frame, std::exception_ptr error) {
+      bool ok = false;
+      int code = Proto::HANDLER_FAILED;
+      if (error) {
+        code = _error_code(error);
+      } else {
+        try {
+          Proto::write_response(request.get_response(), frame);
+          ok = true;
+        } catch(...) {
+          code = _error_code(std::current_exception());
+        }
+      }
+
+      if (!ok) {
+        Proto::write_error(code, frame, request.clientno(), request.messageid());
+      }
+      // a parked retry got a stored response, there is nothing to settle
+      if (_dedup != nullptr && request.get_response().raw_frame() == nullptr) {
+        _settle(request, frame, ok);
+      }
+    }
+
+    /* Store the response in frame for retries of request, or forget the
+     * request if it failed or streamed its response
+     */
+    void _settle(Request& request, FrameBuffer& frame, bool ok) {
+      if (!ok || request.get_response().streamed()) {
+        // a retry needs the streamed frames as well, which aren't kept
+        _abandon(request);
+      } else {
+        _dedup->finish(request.clientno(), request.messageid(), request.handlerid(),
+                       request.timestamp(), request.raw_hash(), frame.payload(),
+                       frame.payload_size());
+      }
+    }
+
+    /* Forget request in the dedup table and run the retries parked on it */
+    void _abandon(Request& request) {
+      std::vector<std::shared_ptr<Request> > parked =
+          _dedup->abandon(request.clientno(), request.messageid(), request.handlerid(),
+                          request.timestamp(), request.raw_hash());
+      for(size_t i = 0; i < parked.size(); i ++) {
+        _rerun(*parked[i]);
+      }
+    }
+
+    /* Run a parked retry whose first copy failed. Its completion writes the
+     * response and settles it, the first retry claims the request again and
+     * the others park on it or get its stored response.
+     */
+    void _rerun(Request& request) {
+      std::string stored;
+      switch (_dedup->claim(request.clientno(), request.messageid(), request.handlerid(),
+                            request.timestamp(), request.raw_hash(), stored, &request)) {
+        case DedupTable::ANSWERED:
+          request.get_response().set_raw_frame(std::make_shared<const std::string>(stored));
+          request.complete();
+          return;
+        case DedupTable::PARKED:
+          return;
+        case DedupTable::RUN:
+          break;
+      }
+
+      try {
+        if (!_run(request, 0)) {
+          return;
+        }
+      } catch(...) {
+        request.complete(std::current_exception());
+        return;
+      }
+      request.complete();
+    }
+
+    /* Hand request to the registered service. Chunks of an uploaded
+     * argument the handler left unread are skipped, also when it fails,
+     * so the connection stays in sync
+     */
+    void _dispatch(Request& request) {
+      try {
+        if (_handler->on_request(&request) == 0) {
+          throw ServerMethodNotFoundException();
+        }
+      } catch(ServerException& e) {
+        if (e.get_code() != Proto::SOCKET_CLOSED) {
+          try {
+            request.drain_upload();
+          } catch(ServerException&) {
+          }
+        }
+        throw;
+      }
+      request.drain_upload();
+    }
+
+    /* Remove the socket file a previous server left behind. A socket
+     * somebody still accepts on is left alone, the path is in use then.
+     */
+    void _unlink_stale(const struct sockaddr_un& addr) {
+      struct stat st;
+      if (lstat(_unix_path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        // nothing there, or not a socket, which bind reports
+        return;
+      }
+
+      // non blocking, so a full backlog doesn't hold the probe
+      int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if (probe < 0) {
+        throw SocketFailException("socket");
+      }
+      int r = ::connect(probe, (const struct sockaddr*)&addr, sizeof(struct sockaddr_un));
+      int err = errno;
+      ::close(probe);
+      if (r == 0 || err != ECONNREFUSED) {
+        throw HostFailException("Address in use", "unix", _unix_path);
+      }
+      unlink(_unix_path.c_str());
+    }
+
+    int _listen_unix() {
+      struct sockaddr_un addr;
+      unix_addr(_unix_path, addr);
+
+      _unlink_stale(addr);
+      _sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (_sock == UNINIT_SOCKET) {
+        throw SocketFailException("socket");
+      }
+      _options.apply_listener(_sock, AF_UNIX);
+
+      int r = bind(_sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_un));
+      if (r != 0) {
+        // the path isn't ours, the destructor must not unlink it
+        ::close(_sock);
+        _sock = UNINIT_SOCKET;
+        throw SocketFailException("bind");
+      }
+
+      r = ::listen(_sock, _options.backlog);
       if (r != 0) {
         throw SocketFailException("listen");
       }
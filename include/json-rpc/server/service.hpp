@@ -5,9 +5,18 @@
 #include "json-rpc/server/sconn.hpp"
 #include <functional>
 #include "json-rpc/errors.hpp"
+#include "json-rpc/bytes.hpp"
+#include "json-rpc/task.hpp"
 #include "jconer/json.hpp"
 #include <functional>
 
+#ifdef JSONRPC_HAS_COROUTINES
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#endif
+
 using namespace JCONER;
 
 /**
@@ -59,6 +68,8 @@ class AbstractService : public ASIO {
         return 0;
       } else {
         try {
+          // Bytes arguments and results live in the raw frame sections
+          AttachmentScope scope(&request->attachments(), &request->get_response().attachments());
           _handlers[handler_id](*dynamic_cast<S*>(this), request);
         } catch (SerializeFailException& e){
           throw ServerParamMismatchException();
@@ -67,9 +78,93 @@ class AbstractService : public ASIO {
       }
     }
 
+#ifdef JSONRPC_HAS_COROUTINES
+    /* Answer req with what task returns, used by the wrappers of methods
+     * marked "async". A task that finishes right away is answered like any
+     * other method. One that suspends takes the request over (see
+     * Request::defer) and the worker thread goes on, the response is sent
+     * from where the task finishes. Connectors that can't send a response
+     * later (set no completion) keep the worker waiting for the task.
+     */
+    template<class R>
+    void serve_task(Request* req, Task<R> task) {
+      std::shared_ptr<TaskRun<R> > run(new TaskRun<R>(std::move(task)));
+      run->task.start([run]() {
+        std::unique_lock<std::mutex> lock(run->mutex);
+        if (run->phase.exchange(TaskRun<R>::FINISHED) == TaskRun<R>::DEFERRED) {
+          lock.unlock();
+          _complete_task(*run);
+          return;
+        }
+        run->cond.notify_all();
+      });
+
+      if (run->phase.load() != TaskRun<R>::FINISHED) {
+        if (!req->can_defer()) {
+          std::unique_lock<std::mutex> lock(run->mutex);
+          run->cond.wait(lock, [&] { return run->phase.load() == TaskRun<R>::FINISHED; });
+        } else {
+          run->request = req->defer();
+          if (run->phase.exchange(TaskRun<R>::DEFERRED) == TaskRun<R>::FINISHED) {
+            // finished while the request was handed over
+            _complete_task(*run);
+          }
+          return;
+        }
+      }
+      _write_result(*req, run->task);
+    }
+#endif
+
   private:
     ServerConnector& _s;
     std::map<size_t, std::function<void(S&, Request*)> > _handlers;
+
+#ifdef JSONRPC_HAS_COROUTINES
+    template<class R>
+    struct TaskRun {
+      enum {
+        RUNNING = 0,
+        FINISHED = 1,
+        DEFERRED = 2
+      };
+
+      TaskRun(Task<R>&& t) : task(std::move(t)), phase(RUNNING) {}
+
+      Task<R> task;
+      std::atomic<int> phase;
+      std::shared_ptr<Request> request;  // once deferred
+      std::mutex mutex;
+      std::condition_variable cond;
+    };
+
+    template<class R>
+    static void _write_result(Request& req, Task<R>& task) {
+      R r = task.result();
+      OutSerializer& sout = req.get_response().get_serializer();
+      sout & r;
+    }
+
+    static void _write_result(Request& req, Task<void>& task) {
+      task.result();
+    }
+
+    /* Write the result of a deferred request and send it */
+    template<class R>
+    static void _complete_task(TaskRun<R>& run) {
+      Request& req = *run.request;
+      std::exception_ptr error;
+      try {
+        AttachmentScope scope(&req.attachments(), &req.get_response().attachments());
+        _write_result(req, run.task);
+      } catch(SerializeFailException& e) {
+        error = std::make_exception_ptr(ServerParamMismatchException());
+      } catch(...) {
+        error = std::current_exception();
+      }
+      req.complete(error);
+    }
+#endif
 };
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef __JSONRPC_SHMSERVER_HPP__
+#define __JSONRPC_SHMSERVER_HPP__
+
+#include "json-rpc/util.hpp"
+#include "json-rpc/shmring.hpp"
+#include "json-rpc/server/sconn.hpp"
+#include "json-rpc/server/request.hpp"
+#include "json-rpc/server/asio.hpp"
+#include "json-rpc/errors.hpp"
+#include "common/all.hpp"
+
+#include <list>
+
+class ShmSession;
+
+/**
+ * Server connector for ShmClient. Clients connect to the unix domain socket
+ * at path and hand over a shared segment, then every request and response
+ * goes through the rings of that segment. Each client is served by its own
+ * thread, like SockServer.
+ **/
+class ShmServer : public ServerConnector {
+  public:
+    ShmServer(UnixPath path);
+
+    int start();
+    int stop();
+
+    void loop();
+
+    /* Largest request frame a client may send, a larger one closes its
+     * connection. Has to be set before start.
+     */
+    void set_max_frame(size_t bytes) { _max_frame = bytes; }
+
+    virtual ~ShmServer();
+
+  private:
+    bool _stop;
+    size_t _max_frame;
+    Mutex _mutex;
+    std::list<ShmSession*> _sessions;
+
+    void _reap_sessions(bool all);
+
+    class ServerLoopThread : public Thread {
+      public:
+        ServerLoopThread(ShmServer* pserver) :Thread(), _pserver(pserver) {
+        }
+        void run() {
+          _pserver->loop();
+        }
+
+      private:
+        ShmServer* _pserver;
+    };
+
+    friend class ServerLoopThread;
+    friend class ShmSession;
+    ServerLoopThread _thread;
+};
+
+/**
+ * One client of a ShmServer and the thread serving it
+ **/
+class ShmSession : public Thread {
+  public:
+    ShmSession(ShmServer* pserver, int sock)
+        :Thread(), _pserver(pserver), _sock(sock), _done(false) {
+    }
+
+    ~ShmSession();
+
+    void run();
+    void shutdown();
+    bool done() const { return _done; }
+
+  private:
+    ShmServer* _pserver;
+    int _sock;
+    volatile bool _done;
+    ShmSegment _segment;
+};
+
+#endif
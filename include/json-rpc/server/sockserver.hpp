@@ -17,6 +17,7 @@ class ConnectionThread;
 class SockServer : public ServerConnector {
   public:
     SockServer(std::string port);
+    SockServer(UnixPath path);
 
     int start();
     int stop();
@@ -54,6 +55,7 @@ class SockServer : public ServerConnector {
 
     friend class ServerLoopThread;
     friend class ConnectionThread;
+    friend class Connection;
     ServerLoopThread _thread;
 
     /* Connection pool. The max size of this list is detemined by _pool_size
@@ -118,9 +120,10 @@ class Connection {
     ConnectionThread _thread;
 
     std::string _recv();
-    void _send(std::string msg);
+    void _send(const std::string& msg);
 
-    void _send_response(Response& resp);
+    /* Run request and send back its response */
+    void _send_response(Request& request);
     void _send_error(int code);
 };
 
@@ -0,0 +1,115 @@
+#ifndef __JSONRPC_STREAM_HPP__
+#define __JSONRPC_STREAM_HPP__
+
+#include "json-rpc/server/request.hpp"
+#include "json-rpc/proto.hpp"
+
+#include <cstddef>
+#include <iterator>
+
+/**
+ * Handed to service methods marked "stream" in the spec. Every write sends
+ * one element (or chunk) to the client as its own frame, so neither side has
+ * to hold the whole result. The regular response that follows when the
+ * method returns ends the stream.
+ **/
+template<class T>
+class StreamWriter {
+  public:
+    StreamWriter(Response& resp) : _resp(resp) {}
+
+    void write(T& value) {
+      // every frame carries the attachments of its own element
+      std::string attachments;
+      OutSerializer sout;
+      {
+        AttachmentScope scope(nullptr, &attachments);
+        sout & value;
+      }
+      _resp.send_frame(Proto::build_chunk(sout, attachments));
+    }
+
+    StreamWriter& operator<<(T& value) {
+      write(value);
+      return *this;
+    }
+
+  private:
+    Response& _resp;
+};
+
+/**
+ * Handed to service methods for a parameter of type stream<T> in the spec.
+ * The client sends that argument as a sequence of chunk frames after the
+ * request, and the reader hands them out as they arrive, so the argument
+ * never has to be in memory as a whole.
+ *
+ *   T item;
+ *   while (reader.next(item)) { ... }
+ *
+ * or as an input range
+ *
+ *   for (T& item : reader) { ... }
+ **/
+template<class T>
+class StreamReader {
+  public:
+    StreamReader(Request& req) : _req(req) {}
+
+    bool next(T& value) {
+      std::string attachments;
+      JValue* chunk = _req.next_chunk(&attachments);
+      if (chunk == nullptr) {
+        return false;
+      }
+
+      try {
+        AttachmentScope scope(&attachments, nullptr);
+        InSerializer sin(chunk->get(Chunk));
+        sin & value;
+      } catch (SerializeFailException& e) {
+        delete chunk;
+        throw;
+      }
+      delete chunk;
+      return true;
+    }
+
+    class iterator {
+      public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        iterator(StreamReader* reader) : _reader(reader) {
+          ++ *this;
+        }
+
+        T& operator*() { return _value; }
+        T* operator->() { return &_value; }
+
+        iterator& operator++() {
+          if (_reader && !_reader->next(_value)) {
+            _reader = nullptr;
+          }
+          return *this;
+        }
+
+        bool operator==(const iterator& o) const { return _reader == o._reader; }
+        bool operator!=(const iterator& o) const { return _reader != o._reader; }
+
+      private:
+        StreamReader* _reader;
+        T _value;
+    };
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(nullptr); }
+
+  private:
+    Request& _req;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __JSONRPC_SHMRING_HPP__
+#define __JSONRPC_SHMRING_HPP__
+
+#include "common/all.hpp"
+
+#include <atomic>
+#include <climits>
+#include <string>
+#include <stdint.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared memory rings need address free 64 bit atomics");
+
+/**
+ * Control block of one ring, lives in the shared segment. Producer and
+ * consumer positions sit on their own cache lines.
+ **/
+struct ShmRingHeader {
+  alignas(64) std::atomic<uint64_t> head;           // bytes written so far
+  alignas(64) std::atomic<uint64_t> tail;           // bytes read so far
+  alignas(64) std::atomic<uint32_t> reader_waiting; // reader sleeps on data fd
+  std::atomic<uint32_t> writer_waiting;             // writer sleeps on space fd
+};
+
+/**
+ * Single producer single consumer byte ring in shared memory. Each side
+ * spins for a short while when the ring is empty (or full) and only then
+ * announces it is going to sleep on an eventfd, so the peer pays for a
+ * wakeup syscall only when this side is idle. Frames use the same layout as
+ * the socket connectors, an int size followed by the message.
+ **/
+class ShmRing {
+  public:
+    ShmRing()
+        : _hdr(nullptr), _data(nullptr), _capacity(0),
+          _data_fd(-1), _space_fd(-1), _peer(-1), _max_frame(INT_MAX) {
+    }
+
+    void attach(ShmRingHeader* hdr, char* data, size_t capacity,
+                int data_fd, int space_fd, int peer);
+
+    /* Both return false if the peer went away, or left the ring in a
+     * state it can't be in
+     */
+    bool write_frame(const std::string& msg);
+    bool read_frame(std::string& msg);
+
+    /* Frames read larger than max break the connection */
+    void set_max_frame(size_t max) { _max_frame = max; }
+
+  private:
+    ShmRingHeader* _hdr;
+    char* _data;
+    size_t _capacity;
+    int _data_fd;   // signaled when bytes are written
+    int _space_fd;  // signaled when bytes are read
+    int _peer;      // control socket, hangs up when the peer dies
+    size_t _max_frame;
+
+    bool _write(const char* buf, size_t len);
+    bool _read(char* buf, size_t len);
+    bool _wait(int fd);
+};
+
+/**
+ * A shared segment holding a request ring and a response ring, plus the
+ * eventfds used for wakeups. The client creates it and hands the memfd and
+ * eventfds to the server over a unix domain socket.
+ **/
+class ShmSegment {
+  CLASS_NOCOPY(ShmSegment)
+  public:
+    enum Side {
+      CLIENT = 0,
+      SERVER = 1,
+    };
+
+    ShmSegment();
+    ~ShmSegment();
+
+    bool create(size_t capacity);
+    bool send_to(int sock);
+    bool recv_from(int sock);
+
+    /* Wire up the rings for one side, peer is the control socket */
+    void bind(Side side, int peer);
+
+    ShmRing& in() { return _in; }
+    ShmRing& out() { return _out; }
+
+  private:
+    enum {
+      REQ_DATA = 0,
+      REQ_SPACE,
+      RESP_DATA,
+      RESP_SPACE,
+      EVENT_FDS,
+    };
+
+    int _memfd;
+    int _efds[EVENT_FDS];
+    void* _base;
+    size_t _length;
+    size_t _capacity;
+
+    ShmRing _in;
+    ShmRing _out;
+
+    bool _map();
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __JSONRPC_SOCKOPT_HPP__
+#define __JSONRPC_SOCKOPT_HPP__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const int MAX_QUEUE_SIZE = 100;
+
+/**
+ * Socket tuning knobs shared by server and client connectors. Anything left
+ * at its default is not touched, tcp only options are skipped on unix domain
+ * sockets.
+ **/
+struct SocketOptions {
+  SocketOptions()
+      : nodelay(false), quickack(false), sndbuf(0), rcvbuf(0),
+        backlog(MAX_QUEUE_SIZE), busy_poll(0), fastopen(0) {
+  }
+
+  bool nodelay;   // TCP_NODELAY, turn off Nagle
+  bool quickack;  // TCP_QUICKACK, re-armed after every read since it doesn't stick
+  int sndbuf;     // SO_SNDBUF in bytes
+  int rcvbuf;     // SO_RCVBUF in bytes
+  int backlog;    // listen backlog
+  int busy_poll;  // SO_BUSY_POLL in microseconds
+  int fastopen;   // TCP_FASTOPEN queue length on listeners, enables it on clients
+
+  /* Before bind and listen */
+  void apply_listener(int fd, int family) const {
+    _apply_buffers(fd);
+    if (_is_tcp(family) && fastopen > 0) {
+      _set(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen);
+    }
+  }
+
+  /* On accepted sockets, and on client sockets before connect */
+  void apply_connection(int fd, int family, bool client = false) const {
+    _apply_buffers(fd);
+    if (busy_poll > 0) {
+      _set(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll);
+    }
+    if (!_is_tcp(family)) return;
+
+    if (nodelay) {
+      _set(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+    if (client && fastopen > 0) {
+#ifdef TCP_FASTOPEN_CONNECT
+      _set(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#endif
+    }
+    rearm(fd, family);
+  }
+
+  /* Options the kernel resets on its own */
+  void rearm(int fd, int family) const {
+    if (quickack && _is_tcp(family)) {
+      _set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+  }
+
+  private:
+    static bool _is_tcp(int family) {
+      return family == AF_INET || family == AF_INET6;
+    }
+
+    static void _set(int fd, int level, int name, int value) {
+      setsockopt(fd, level, name, &value, sizeof value);
+    }
+
+    void _apply_buffers(int fd) const {
+      if (sndbuf > 0) {
+        _set(fd, SOL_SOCKET, SO_SNDBUF, sndbuf);
+      }
+      if (rcvbuf > 0) {
+        _set(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf);
+      }
+    }
+};
+
+#endif
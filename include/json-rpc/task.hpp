@@ -0,0 +1,207 @@
+#ifndef __JSONRPC_TASK_HPP__
+#define __JSONRPC_TASK_HPP__
+
+/* Coroutine support is there when the compiler runs with -std=c++20 (or
+ * later), the rest of the library stays C++11
+ */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define JSONRPC_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef JSONRPC_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+/**
+ * Result of a coroutine, returned by service methods marked "async" in the
+ * spec and by the co_ methods of generated clients. A task starts when it
+ * is co_awaited (or started by the server connector), and the coroutine
+ * awaiting it resumes right where it finished, on whatever thread that was.
+ **/
+template<class R>
+class Task;
+
+namespace task_detail {
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  std::function<void()> on_done;
+  std::exception_ptr error;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      PromiseBase& promise = h.promise();
+      if (promise.continuation) {
+        return promise.continuation;
+      }
+      if (promise.on_done) {
+        // may destroy the task, the frame is suspended by now
+        std::function<void()> done = std::move(promise.on_done);
+        done();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+}
+
+template<class R>
+class Task {
+  public:
+    struct promise_type : task_detail::PromiseBase {
+      std::optional<R> value;
+
+      Task get_return_object() {
+        return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      template<class V>
+      void return_value(V&& v) { value.emplace(std::forward<V>(v)); }
+    };
+
+    Task(Task&& o) : _handle(o._handle) { o._handle = nullptr; }
+    Task& operator=(Task&& o) {
+      if (this != &o) {
+        if (_handle) _handle.destroy();
+        _handle = o._handle;
+        o._handle = nullptr;
+      }
+      return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+      if (_handle) _handle.destroy();
+    }
+
+    /* Run the coroutine, on_done is called where it finishes. That may
+     * well be before start returns.
+     */
+    void start(std::function<void()> on_done) {
+      _handle.promise().on_done = std::move(on_done);
+      _handle.resume();
+    }
+
+    bool done() const { return _handle.done(); }
+
+    /* The returned value of a finished task, or the exception it threw */
+    R result() {
+      promise_type& promise = _handle.promise();
+      if (promise.error) {
+        std::rethrow_exception(promise.error);
+      }
+      return std::move(*promise.value);
+    }
+
+    auto operator co_await() && noexcept {
+      struct Awaiter {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+          handle.promise().continuation = awaiting;
+          return handle;
+        }
+        R await_resume() {
+          promise_type& promise = handle.promise();
+          if (promise.error) {
+            std::rethrow_exception(promise.error);
+          }
+          return std::move(*promise.value);
+        }
+      };
+      return Awaiter{_handle};
+    }
+
+  private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+template<>
+class Task<void> {
+  public:
+    struct promise_type : task_detail::PromiseBase {
+      Task get_return_object() {
+        return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      void return_void() {}
+    };
+
+    Task(Task&& o) : _handle(o._handle) { o._handle = nullptr; }
+    Task& operator=(Task&& o) {
+      if (this != &o) {
+        if (_handle) _handle.destroy();
+        _handle = o._handle;
+        o._handle = nullptr;
+      }
+      return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+      if (_handle) _handle.destroy();
+    }
+
+    void start(std::function<void()> on_done) {
+      _handle.promise().on_done = std::move(on_done);
+      _handle.resume();
+    }
+
+    bool done() const { return _handle.done(); }
+
+    void result() {
+      if (_handle.promise().error) {
+        std::rethrow_exception(_handle.promise().error);
+      }
+    }
+
+    auto operator co_await() && noexcept {
+      struct Awaiter {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+          handle.promise().continuation = awaiting;
+          return handle;
+        }
+        void await_resume() {
+          if (handle.promise().error) {
+            std::rethrow_exception(handle.promise().error);
+          }
+        }
+      };
+      return Awaiter{_handle};
+    }
+
+  private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __JSONRPC_TIMERWHEEL_HPP__
+#define __JSONRPC_TIMERWHEEL_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * Hierarchical timing wheel, four levels of 64 slots with a tick of one
+ * millisecond. Level 0 holds what expires within 64 ticks, each level above
+ * covers 64 times the span of the one below, up to about four and a half
+ * hours; later timers wait in the top level and move down again. Adding and
+ * cancelling a timer are O(1), a tick runs one slot and every 64th moves one
+ * slot of the level above down.
+ *
+ * Not thread safe, the owner (the PollServer reactor) drives it with
+ * advance and runs the callbacks on its own thread.
+ **/
+class TimerWheel {
+  public:
+    typedef uint64_t TimerId;
+
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    /* now_ms is where the clock of the wheel starts */
+    explicit TimerWheel(uint64_t now_ms);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /* Run fn on the first advance at least delay_ms later */
+    TimerId schedule(long delay_ms, std::function<void()> fn);
+
+    /* False if the timer ran or was cancelled already */
+    bool cancel(TimerId id);
+
+    /* Run every timer due by now_ms, in order of expiry tick */
+    void advance(uint64_t now_ms);
+
+    /* Milliseconds advance can wait without running a timer late, -1 if
+     * there is none. Timers beyond level 0 are counted from the next time a
+     * slot of theirs moves down, which may come earlier than them.
+     */
+    long next_timeout(uint64_t now_ms) const;
+
+    size_t size() const { return _timers.size(); }
+
+  private:
+    struct Timer {
+      TimerId id;
+      uint64_t expires;   // tick
+      std::function<void()> fn;
+      Timer* prev;
+      Timer* next;
+    };
+
+    /* Sentinel of a slot's list */
+    struct Slot {
+      Timer head;
+      Slot() { head.prev = head.next = &head; }
+      bool empty() const { return head.next == &head; }
+    };
+
+    Slot _slots[LEVELS][SLOTS];
+    uint64_t _current;  // next tick to run
+    TimerId _next_id;
+    std::unordered_map<TimerId, Timer*> _timers;
+
+    void _place(Timer* timer);
+    void _cascade(int level);
+    static void _unlink(Timer* timer);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef __JSONRPC_TRACE_HPP__
+#define __JSONRPC_TRACE_HPP__
+
+#include "common/all.hpp"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * One finished span. Name has to be a string literal, spans only keep the
+ * pointer.
+ **/
+struct TraceSpan {
+  const char* name;
+  uint64_t start;  // ns, steady clock
+  uint64_t dur;    // ns
+  uint64_t id;     // trace id of the sampled request
+};
+
+/**
+ * Fixed size ring of spans owned by one thread. Only the owner writes, so
+ * recording is a couple of stores and no lock. Readers copy slots out and
+ * use the per slot sequence number to drop the ones being overwritten.
+ **/
+class TraceRing {
+  public:
+    static const size_t CAPACITY = 4096;
+
+    TraceRing(uint32_t tid) : _tid(tid), _head(0) {
+      for(size_t i = 0; i < CAPACITY; i ++) {
+        _slots[i].seq.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void push(const char* name, uint64_t start, uint64_t end, uint64_t id);
+    void snapshot(std::vector<TraceSpan>& spans) const;
+
+    uint32_t tid() const { return _tid; }
+
+  private:
+    struct Slot {
+      std::atomic<uint64_t> seq;
+      TraceSpan span;
+    };
+
+    uint32_t _tid;
+    std::atomic<uint64_t> _head;
+    Slot _slots[CAPACITY];
+};
+
+/**
+ * Process wide span collector. Requests are sampled when they start and
+ * every span of a sampled request carries its trace id. The collected spans
+ * can be dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ **/
+class Tracer {
+  CLASS_NOCOPY(Tracer)
+  public:
+    static Tracer& get_instance() { return _instance; }
+
+    /* Fraction of requests to trace, 0 turns tracing off, 1 traces all */
+    void set_sample_rate(double rate);
+
+    /* Return a new trace id if this request should be traced, otherwise 0 */
+    uint64_t start_trace();
+
+    void record(const char* name, uint64_t start, uint64_t end, uint64_t id) {
+      _local_ring()->push(name, start, end, id);
+    }
+
+    inline bool enabled() const {
+      return _period.load(std::memory_order_relaxed) != 0;
+    }
+
+    std::string dump();
+    bool dump(const std::string& filename);
+
+    static uint64_t now();
+
+  private:
+    std::atomic<uint32_t> _period;    // trace one out of _period requests
+    std::atomic<uint64_t> _next_id;
+
+    Mutex _mutex;                     // only guards registering a new ring
+    std::vector<TraceRing*> _rings;
+
+    TraceRing* _local_ring();
+
+    static Tracer _instance;
+    Tracer();
+};
+
+/**
+ * Record a span covering the lifetime of this object when id is not 0
+ **/
+class TraceScope {
+  public:
+    TraceScope(const char* name, uint64_t id)
+        : _name(name), _id(id), _start(id ? Tracer::now() : 0) {
+    }
+
+    ~TraceScope() {
+      if (_id) {
+        Tracer::get_instance().record(_name, _start, Tracer::now(), _id);
+      }
+    }
+
+  private:
+    const char* _name;
+    uint64_t _id;
+    uint64_t _start;
+};
+
+#endif
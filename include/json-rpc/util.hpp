@@ -2,6 +2,10 @@
 #define __JSONPRC_UTIL_HPP__
 
 #include <fcntl.h>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 static inline void nonblock_fd(int fd) {
   int flag = fcntl(fd, F_GETFL, 0);
@@ -17,4 +21,23 @@ static inline void block_df(int fd) {
 
 static const int UNINIT_SOCKET = -1;
 
+/**
+ * Path of a unix domain socket. Connectors take it instead of a host and port
+ * to talk to a peer on the same host without going through the tcp stack.
+ **/
+struct UnixPath {
+  explicit UnixPath(std::string p) : path(p) {}
+  std::string path;
+};
+
+static inline bool unix_addr(const std::string& path, struct sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
 #endif
@@ -3,8 +3,13 @@
 
 #include "common/all.hpp"
 #include "jconer/json.hpp"
+#include "stubgen/options.hpp"
 #include <sstream>
 #include <cassert>
+#include <cctype>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
 
 using namespace COMMON;
 using JCONER::JValue;
@@ -13,16 +18,18 @@ class CppWriter;
 
 class ClassDef {
   public:
-    ClassDef() : _name("") {
+    ClassDef() : _name(""), _columnar(false) {
         _members.clear();
     }
 
-    ClassDef(const ClassDef& other) : _name(other._name) {
+    ClassDef(const ClassDef& other) : _name(other._name), _columnar(other._columnar),
+                                      _columns(other._columns) {
         _members.clear();
         _members.insert(other._members.begin(), other._members.end());
     }
 
-    ClassDef(ClassDef&& other) : _name(other._name), _members(std::move(other._members))  {
+    ClassDef(ClassDef&& other) : _name(other._name), _members(std::move(other._members)),
+                                 _columnar(other._columnar), _columns(std::move(other._columns)) {
     }
 
     void add_member(std::string name, std::string type) {
@@ -38,16 +45,236 @@ class ClassDef {
 
     const std::string get_name() const { return _name; }
 
-    static ClassDef from_json(std::string name, JValue* value);
+    /* Vectors of the class are sent column by column, as
+     * [names, column, ...], each column being the c++ type in _columns
+     */
+    bool is_columnar() const { return _columnar; }
+    const std::string get_vector_name() const { return _name + "Vector"; }
+
+    /* Translate a spec type to c++, "bytes" and "blob" become Bytes, which
+     * travels as raw attachment instead of json text. With the numeric fast
+     * path vectors of ints or doubles become NumArray. Vectors of columnar
+     * classes become their generated vector, with binary_pod vectors of
+     * fixed layout classes become PodArray.
+     */
+    static std::string cpp_type(const std::string& type, const SpecOptions& options) {
+      std::string result;
+      size_t i = 0;
+      while (i < type.size()) {
+        if (!_is_ident(type[i])) {
+          result += type[i ++];
+          continue;
+        }
+
+        size_t j = i;
+        while (j < type.size() && _is_ident(type[j])) j ++;
+        std::string word = type.substr(i, j - i);
+        i = j;
+
+        if (word == "bytes" || word == "blob") {
+          result += "Bytes";
+          continue;
+        }
+
+        std::string elem;
+        size_t end = i;
+        if ((word == "std::vector" || word == "vector") && _template_arg(type, end, elem)) {
+          if (options.numeric_fastpath && _is_numeric(elem)) {
+            result += "NumArray<" + elem + ">";
+            i = end;
+            continue;
+          }
+          if (options.columnar.count(elem) != 0) {
+            result += elem + "Vector";
+            i = end;
+            continue;
+          }
+          if (options.binary_pod && options.pod_classes.count(elem) != 0) {
+            result += "PodArray<" + elem + ">";
+            i = end;
+            continue;
+          }
+        }
+        result += word;
+      }
+      return result;
+    }
+
+    /* Check if type refers to name as a whole word */
+    static bool refers_to(const std::string& type, const std::string& name) {
+      size_t pos = type.find(name);
+      while (pos != std::string::npos) {
+        size_t end = pos + name.size();
+        if ((pos == 0 || !_is_ident(type[pos - 1])) &&
+            (end == type.size() || !_is_ident(type[end]))) {
+          return true;
+        }
+        pos = type.find(name, pos + 1);
+      }
+      return false;
+    }
+
+    /* Size and alignment of a fixed width scalar, or of a std::array of
+     * them. False for any other type, int is taken as 32 bits, long isn't
+     * fixed width.
+     */
+    static bool pod_type(const std::string& type, size_t& size, size_t& align) {
+      static const struct { const char* name; size_t size; } scalars[] = {
+        {"char", 1}, {"int8_t", 1}, {"uint8_t", 1},
+        {"short", 2}, {"int16_t", 2}, {"uint16_t", 2},
+        {"int", 4}, {"unsigned", 4}, {"unsigned int", 4}, {"int32_t", 4}, {"uint32_t", 4},
+        {"float", 4},
+        {"long long", 8}, {"unsigned long long", 8}, {"int64_t", 8}, {"uint64_t", 8},
+        {"double", 8}
+      };
+
+      std::string elem;
+      size_t count = 1;
+      if (!array_type(type, elem, count)) {
+        elem = _trim(type);
+      }
+      for(size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); i ++) {
+        if (elem == scalars[i].name) {
+          size = scalars[i].size * count;
+          align = scalars[i].size;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /* Split "std::array<T, N>" into T and N */
+    static bool array_type(const std::string& type, std::string& elem, size_t& count) {
+      std::string t = _trim(type);
+      size_t pos;
+      if (t.compare(0, 10, "std::array") == 0) {
+        pos = 10;
+      } else if (t.compare(0, 5, "array") == 0) {
+        pos = 5;
+      } else {
+        return false;
+      }
+
+      std::string arg;
+      if (!_template_arg(t, pos, arg) || pos != t.size()) return false;
+      size_t comma = arg.rfind(',');
+      if (comma == std::string::npos) return false;
+
+      elem = _trim(arg.substr(0, comma));
+      std::string n = _trim(arg.substr(comma + 1));
+      if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos) return false;
+      count = atoi(n.c_str());
+      return count > 0;
+    }
+
+    /* Check if a spec class has a fixed layout, all its members fixed width
+     * scalars or arrays of them
+     */
+    static bool is_pod_spec(JValue* value) {
+      if (!value->isObject() || value->size() == 0) return false;
+      auto keys = value->getKeys();
+      for(size_t i = 0; i < keys.size(); i ++) {
+        JValue* type = value->get(keys[i]);
+        size_t size, align;
+        if (!type->isString() || !pod_type(type->getString(), size, align)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool is_pod() const {
+      if (_members.empty()) return false;
+      auto it = _members.begin();
+      for(; it != _members.end(); it ++) {
+        size_t size, align;
+        if (!pod_type(it->second, size, align)) return false;
+      }
+      return true;
+    }
+
+    /* Layout of a fixed layout class, members by alignment, widest first,
+     * so there are no holes between them. Returns the size of the record,
+     * padding at the end to the widest alignment included.
+     */
+    size_t pod_layout(std::vector<std::pair<std::string, size_t> >& offsets) const {
+      std::vector<std::pair<size_t, std::string> > order;
+      size_t max_align = 1;
+      auto it = _members.begin();
+      for(; it != _members.end(); it ++) {
+        size_t size, align;
+        pod_type(it->second, size, align);
+        order.push_back(std::make_pair(align, it->first));
+        max_align = std::max(max_align, align);
+      }
+      std::stable_sort(order.begin(), order.end(),
+          [](const std::pair<size_t, std::string>& a, const std::pair<size_t, std::string>& b) {
+            return a.first > b.first;
+          });
+
+      size_t offset = 0;
+      offsets.clear();
+      for(size_t i = 0; i < order.size(); i ++) {
+        size_t size, align;
+        pod_type(_members.find(order[i].second)->second, size, align);
+        offsets.push_back(std::make_pair(order[i].second, offset));
+        offset += size;
+      }
+      return (offset + max_align - 1) / max_align * max_align;
+    }
+
+    static ClassDef from_json(std::string name, JValue* value, const SpecOptions& options);
 
     friend class CppWriter;
 
   private:
     std::string _name;
     std::map<std::string, std::string> _members;
+    bool _columnar;
+    std::map<std::string, std::string> _columns;
+
+    static bool _is_ident(char c) {
+      return isalnum(c) || c == '_' || c == ':';
+    }
+
+    static std::string _trim(const std::string& str) {
+      size_t first = str.find_first_not_of(' ');
+      if (first == std::string::npos) return "";
+      size_t last = str.find_last_not_of(' ');
+      return str.substr(first, last - first + 1);
+    }
+
+    /* Read "<T>" at pos, pos moves past it. Nested arguments aren't taken. */
+    static bool _template_arg(const std::string& type, size_t& pos, std::string& arg) {
+      size_t open = type.find_first_not_of(' ', pos);
+      if (open == std::string::npos || type[open] != '<') return false;
+      size_t close = type.find('>', open);
+      if (close == std::string::npos) return false;
+      if (type.find('<', open + 1) < close) return false;
+
+      arg = _trim(type.substr(open + 1, close - open - 1));
+      if (arg.empty()) return false;
+      pos = close + 1;
+      return true;
+    }
+
+    /* Check if T is a number type NumArray takes */
+    static bool _is_numeric(const std::string& type) {
+      static const char* numbers[] = {
+        "int", "long", "long long", "unsigned", "unsigned int", "unsigned long",
+        "short", "int32_t", "int64_t", "uint32_t", "uint64_t", "double", "float"
+      };
+
+      for(size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i ++) {
+        if (type == numbers[i]) {
+          return true;
+        }
+      }
+      return false;
+    }
 };
 
-ClassDef ClassDef::from_json(std::string name, JValue* value) {
+ClassDef ClassDef::from_json(std::string name, JValue* value, const SpecOptions& options) {
   assert(value->isObject());
 
   ClassDef def;
@@ -55,7 +282,18 @@ ClassDef ClassDef::from_json(std::string name, JValue* value) {
   auto keys = value->getKeys();
 
   for(int i = 0; i < keys.size(); i ++) {
-    def.add_member(keys[i], value->get(keys[i])->getString());
+    def.add_member(keys[i], cpp_type(value->get(keys[i])->getString(), options));
+  }
+
+  if (options.columnar.count(name) != 0) {
+    assert(keys.size() != 0);
+    // a column is a vector of the member type, so numbers take the numeric
+    // fast path and columnar members nest
+    def._columnar = true;
+    for(int i = 0; i < keys.size(); i ++) {
+      def._columns[keys[i]] = cpp_type("std::vector<" + value->get(keys[i])->getString() + ">",
+                                       options);
+    }
   }
 
   return def;
@@ -0,0 +1,56 @@
+#ifndef __JSONRPC_OPTIONS_HPP__
+#define __JSONRPC_OPTIONS_HPP__
+
+#include "jconer/json.hpp"
+#include <cassert>
+#include <set>
+#include <string>
+
+using JCONER::JValue;
+
+/**
+ * Switches set at the top level of a spec, next to "namespace"
+ **/
+class SpecOptions {
+  public:
+    SpecOptions() : numeric_fastpath(false), binary_pod(false) {}
+
+    /* std::vector of ints or doubles becomes NumArray */
+    bool numeric_fastpath;
+
+    /* std::vector of a fixed layout class becomes PodArray */
+    bool binary_pod;
+
+    /* Classes of the spec with a fixed layout, see ClassDef::is_pod */
+    std::set<std::string> pod_classes;
+
+    /* Classes whose vectors go column by column, std::vector<T> of them
+     * becomes the generated TVector
+     */
+    std::set<std::string> columnar;
+
+    static SpecOptions from_json(JValue* spec) {
+      SpecOptions options;
+      JValue* value = spec->get("numeric_fastpath");
+      if (value != NULL) {
+        assert(value->isBool());
+        options.numeric_fastpath = value->getBool();
+      }
+      value = spec->get("binary_pod");
+      if (value != NULL) {
+        assert(value->isBool());
+        options.binary_pod = value->getBool();
+      }
+      value = spec->get("columnar");
+      if (value != NULL) {
+        assert(value->isArray());
+        for(int i = 0; i < value->size(); i ++) {
+          assert(value->get(i)->isString());
+          options.columnar.insert(value->get(i)->getString());
+        }
+      }
+      return options;
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common/all.hpp"
 #include "jconer/json.hpp"
+#include "stubgen/classdef.hpp"
 
 #include <sstream>
 
@@ -22,28 +23,47 @@ class ServiceDef {
 
     class Function {
       public:
-        Function(): _name(""), _rettype("void"), _cname("") {
+        Function(): _name(""), _rettype("void"), _cname(""), _stream(false),
+                    _cache_ttl_ms(0), _cache_entries(0),
+                    _client_ttl_ms(0), _client_entries(0), _coalesce(false),
+                    _batch_window_us(0), _batch_max(0), _async(false), _deferred(false) {
           _params.clear();
         }
 
         Function(std::string name)
-            : _name(name), _rettype("void"), _cname("") {
+            : _name(name), _rettype("void"), _cname(""), _stream(false),
+              _cache_ttl_ms(0), _cache_entries(0),
+              _client_ttl_ms(0), _client_entries(0), _coalesce(false),
+              _batch_window_us(0), _batch_max(0), _async(false), _deferred(false) {
           _params.clear();
         }
 
         Function(std::string name, std::string cname)
-            : _name(name), _rettype("void"), _cname(cname) {
+            : _name(name), _rettype("void"), _cname(cname), _stream(false),
+              _cache_ttl_ms(0), _cache_entries(0),
+              _client_ttl_ms(0), _client_entries(0), _coalesce(false),
+              _batch_window_us(0), _batch_max(0), _async(false), _deferred(false) {
           _params.clear();
         }
 
         Function(const Function& other)
-            : _name(other._name), _rettype(other._rettype) , _cname(other._cname) {
+            : _name(other._name), _rettype(other._rettype) , _cname(other._cname),
+              _stream(other._stream), _cache_ttl_ms(other._cache_ttl_ms),
+              _cache_entries(other._cache_entries), _client_ttl_ms(other._client_ttl_ms),
+              _client_entries(other._client_entries), _coalesce(other._coalesce),
+              _batch_window_us(other._batch_window_us), _batch_max(other._batch_max),
+              _async(other._async), _deferred(other._deferred) {
           _params.clear();
           _params.insert(other._params.begin(), other._params.end());
         }
 
         Function(Function&& other)
-            : _name(other._name), _rettype(other._rettype), _cname(other._cname) {
+            : _name(other._name), _rettype(other._rettype), _cname(other._cname),
+              _stream(other._stream), _cache_ttl_ms(other._cache_ttl_ms),
+              _cache_entries(other._cache_entries), _client_ttl_ms(other._client_ttl_ms),
+              _client_entries(other._client_entries), _coalesce(other._coalesce),
+              _batch_window_us(other._batch_window_us), _batch_max(other._batch_max),
+              _async(other._async), _deferred(other._deferred) {
           _params = std::move(other._params);
         }
 
@@ -51,6 +71,16 @@ class ServiceDef {
           _name = other._name;
           _rettype = other._rettype;
           _cname = other._cname;
+          _stream = other._stream;
+          _cache_ttl_ms = other._cache_ttl_ms;
+          _cache_entries = other._cache_entries;
+          _client_ttl_ms = other._client_ttl_ms;
+          _client_entries = other._client_entries;
+          _coalesce = other._coalesce;
+          _batch_window_us = other._batch_window_us;
+          _batch_max = other._batch_max;
+          _async = other._async;
+          _deferred = other._deferred;
           _params = std::move(other._params);
           return *this;
         }
@@ -65,13 +95,92 @@ class ServiceDef {
         void set_name(std::string name) { _name = name; }
         void set_cname(std::string cname) { _cname = cname; }
         void set_rettype(std::string type) { _rettype = type; }
+        void set_stream(bool stream) { _stream = stream; }
+        void set_cache(long ttl_ms, long max_entries) {
+          _cache_ttl_ms = ttl_ms;
+          _cache_entries = max_entries;
+        }
+        void set_coalesce(bool coalesce) { _coalesce = coalesce; }
+        void set_batch(long window_us, long max_size) {
+          _batch_window_us = window_us;
+          _batch_max = max_size;
+        }
+        void set_async(bool async) { _async = async; }
+        void set_deferred(bool deferred) { _deferred = deferred; }
+        void set_client_cache(long ttl_ms, long max_entries) {
+          _client_ttl_ms = ttl_ms;
+          _client_entries = max_entries;
+        }
 
         const std::string get_rettype() const { return _rettype; }
         const std::string get_name() const { return _name; }
         const std::map<std::string, std::string>& get_params() const { return _params; }
+        bool is_stream() const { return _stream; }
+
+        /* Results are kept in a ResultCache on the server */
+        bool is_cached() const { return _cache_entries > 0; }
+        long cache_ttl_ms() const { return _cache_ttl_ms; }
+        long cache_entries() const { return _cache_entries; }
+
+        /* Results are kept in a ClientCache in the client */
+        bool is_client_cached() const { return _client_entries > 0; }
+        long client_ttl_ms() const { return _client_ttl_ms; }
+        long client_entries() const { return _client_entries; }
+
+        /* Concurrent identical requests share one run, see Coalescer */
+        bool is_coalesced() const { return _coalesce; }
+
+        /* Concurrent calls run together through <name>Batch, see Batcher */
+        bool is_batchable() const { return _batch_max > 0; }
+        long batch_window_us() const { return _batch_window_us; }
+        long batch_max() const { return _batch_max; }
+
+        /* The service method is a coroutine returning a Task, see
+         * AbstractService::serve_task
+         */
+        bool is_async() const { return _async; }
+
+        /* The service method answers through a Responder, see responder.hpp */
+        bool is_deferred() const { return _deferred; }
+
+        /* A parameter of type stream<T> is uploaded element by element */
+        static bool is_upload_type(const std::string& type) {
+          return type.compare(0, 7, "stream<") == 0 && type[type.size() - 1] == '>';
+        }
+
+        static std::string upload_elem_type(const std::string& type) {
+          return type.substr(7, type.size() - 8);
+        }
+
+        /* Name of the uploaded parameter, empty if there is none */
+        const std::string get_upload() const {
+          auto it = _params.begin();
+          for(; it != _params.end(); it ++) {
+            if (is_upload_type(it->second)) {
+              return it->first;
+            }
+          }
+          return "";
+        }
+
+        /* Type of a parameter as it is declared in the service (or the
+         * client), an uploaded parameter is read through a StreamReader
+         * (or produced by a callback)
+         */
+        static std::string param_decl_type(const std::string& type, bool client) {
+          if (!is_upload_type(type)) {
+            return type;
+          }
+          std::string elem = upload_elem_type(type);
+          return client ? "std::function<bool(" + elem + "&)>" : "StreamReader<" + elem + " >&";
+        }
 
-        const std::string get_declaration(bool with_class = false) const {
-          std::string decl = _rettype + " ";
+        /* extra is appended to the parameter list, streamed methods return
+         * void and take their writer (or callback) that way
+         */
+        const std::string get_declaration(bool with_class = false, std::string extra = "",
+                                          bool client = false) const {
+          std::string decl = (_stream ? "void" : _rettype) + " ";
           if (with_class) {
             decl += _cname +"::";
           }
@@ -79,21 +188,53 @@ class ServiceDef {
 
           auto it = _params.begin();
           for(; it != _params.end(); ) {
-            decl += it->second + " " + it->first;
+            decl += param_decl_type(it->second, client) + " " + it->first;
             if (++it != _params.end()) {
               decl += ", ";
             }
           }
+          if (extra != "") {
+            if (_params.size() != 0) {
+              decl += ", ";
+            }
+            decl += extra;
+          }
           decl += ")";
           return decl;
         }
 
-        static Function from_json(JValue* value);
+        /* Declaration of the method as a coroutine, named prefix + name */
+        const std::string get_task_declaration(std::string prefix = "", bool client = false) const {
+          Function task(*this);
+          task.set_rettype("Task<" + _rettype + " >");
+          task.set_name(prefix + _name);
+          return task.get_declaration(false, "", client);
+        }
+
+        /* Declaration of the service method answering through a Responder */
+        const std::string get_deferred_declaration() const {
+          Function deferred(*this);
+          deferred.set_rettype("void");
+          return deferred.get_declaration(false, "Responder<" + _rettype + " > responder");
+        }
+
+        static Function from_json(JValue* value, const SpecOptions& options);
+        static void cache_limits(JValue* value, long& ttl_ms, long& max_entries);
 
       private:
         std::string _name;
         std::string _rettype;
         std::string _cname; // class name
+        bool _stream;       // result is sent element by element
+        long _cache_ttl_ms;
+        long _cache_entries; // 0 unless the spec sets "cache"
+        long _client_ttl_ms;
+        long _client_entries; // 0 unless the spec sets "client_cache"
+        bool _coalesce;
+        long _batch_window_us;
+        long _batch_max;      // 0 unless the spec sets "batchable"
+        bool _async;
+        bool _deferred;
         std::map<std::string, std::string> _params;
     };
 
@@ -112,7 +253,7 @@ class ServiceDef {
 
     const std::string get_name() const { return _name; }
 
-    static ServiceDef from_json(std::string name, JValue* value);
+    static ServiceDef from_json(std::string name, JValue* value, const SpecOptions& options);
     friend class CppWriter;
 
   private:
@@ -120,12 +261,30 @@ class ServiceDef {
     std::vector<Function> _functions;
 };
 
-ServiceDef::Function ServiceDef::Function::from_json(JValue* value) {
+/* {"ttl_ms" : ..., "max_entries" : ...} of "cache" and "client_cache" */
+void ServiceDef::Function::cache_limits(JValue* value, long& ttl_ms, long& max_entries) {
+  assert(value->isObject());
+  JValue* ttl = value->get("ttl_ms");
+  JValue* entries = value->get("max_entries");
+  assert(ttl != NULL && ttl->isInteger() && ttl->getInteger() > 0);
+  assert(entries != NULL && entries->isInteger() && entries->getInteger() > 0);
+  ttl_ms = ttl->getInteger();
+  max_entries = entries->getInteger();
+}
+
+ServiceDef::Function ServiceDef::Function::from_json(JValue* value, const SpecOptions& options) {
   assert(value->isObject());
 
   JValue* name = value->get("name");
   JValue* param = value->get("params");
   JValue* returns = value->get("return");
+  JValue* stream = value->get("stream");
+  JValue* cache = value->get("cache");
+  JValue* client_cache = value->get("client_cache");
+  JValue* coalesce = value->get("coalesce");
+  JValue* batchable = value->get("batchable");
+  JValue* async = value->get("async");
+  JValue* deferred = value->get("deferred");
 
   assert(name != NULL && name->isString());
   ServiceDef::Function func(name->getString());
@@ -133,25 +292,94 @@ ServiceDef::Function ServiceDef::Function::from_json(JValue* value) {
   assert(param != NULL); 
   if (param->isObject()) {
     std::vector<std::string> keys = param->getKeys();
+    int uploads = 0;
     for(int i = 0; i < keys.size(); i ++ ) {
-      func.add_param(keys[i], param->get(keys[i])->getString());
+      std::string type = ClassDef::cpp_type(param->get(keys[i])->getString(), options);
+      if (Function::is_upload_type(type)) {
+        uploads ++;
+      }
+      func.add_param(keys[i], type);
     }
+    // only one argument can follow the request as frames
+    assert(uploads <= 1);
   } else {
     assert(param->isNull());
   }
 
   if( returns != NULL ) {
     assert( returns->isString());
-    func.set_rettype(returns->getString());
+    func.set_rettype(ClassDef::cpp_type(returns->getString(), options));
+  }
+
+  if (stream != NULL) {
+    assert(stream->isBool());
+    assert(returns != NULL);
+    assert(func.get_upload() == "");
+    func.set_stream(stream->getBool());
+  }
+
+  // only plain calls with a result can be answered from a cache
+  long ttl_ms = 0;
+  long max_entries = 0;
+  if (cache != NULL) {
+    assert(returns != NULL && !func.is_stream() && func.get_upload() == "");
+    cache_limits(cache, ttl_ms, max_entries);
+    func.set_cache(ttl_ms, max_entries);
+  }
+  if (client_cache != NULL) {
+    assert(returns != NULL && !func.is_stream() && func.get_upload() == "");
+    cache_limits(client_cache, ttl_ms, max_entries);
+    func.set_client_cache(ttl_ms, max_entries);
+  }
+  if (coalesce != NULL) {
+    assert(coalesce->isBool());
+    assert(returns != NULL && !func.is_stream() && func.get_upload() == "");
+    func.set_coalesce(coalesce->getBool());
+  }
+  if (batchable != NULL) {
+    // true, or {"window_us" : ..., "max_size" : ...}
+    // a coalesced run is shared already, and its waiters can't join a batch
+    assert(returns != NULL && !func.is_stream() && func.get_upload() == "");
+    assert(!func.is_coalesced());
+    long window_us = 500;
+    long max_size = 32;
+    if (batchable->isObject()) {
+      JValue* window = batchable->get("window_us");
+      JValue* size = batchable->get("max_size");
+      assert(window != NULL && window->isInteger() && window->getInteger() >= 0);
+      assert(size != NULL && size->isInteger() && size->getInteger() > 0);
+      window_us = window->getInteger();
+      max_size = size->getInteger();
+    } else {
+      assert(batchable->isBool());
+      if (!batchable->getBool()) max_size = 0;
+    }
+    func.set_batch(window_us, max_size);
+  }
+  if (async != NULL) {
+    // the response is sent once the task finishes, nothing else goes out
+    // for the request meanwhile
+    assert(async->isBool());
+    assert(!func.is_stream() && func.get_upload() == "");
+    assert(!func.is_cached() && !func.is_coalesced() && !func.is_batchable());
+    func.set_async(async->getBool());
+  }
+  if (deferred != NULL) {
+    // the handler returns before the response is known
+    assert(deferred->isBool());
+    assert(!func.is_stream() && func.get_upload() == "");
+    assert(!func.is_cached() && !func.is_coalesced() && !func.is_batchable());
+    assert(!func.is_async());
+    func.set_deferred(deferred->getBool());
   }
   return func; 
 }
 
-ServiceDef ServiceDef::from_json(std::string name, JValue* value) {
+ServiceDef ServiceDef::from_json(std::string name, JValue* value, const SpecOptions& options) {
   ServiceDef servicedef(name);
 
   for(int i = 0; i < value->size(); i ++ ) {
-    ServiceDef::Function func = ServiceDef::Function::from_json(value->get(i));
+    ServiceDef::Function func = ServiceDef::Function::from_json(value->get(i), options);
     func.set_cname(servicedef.get_name());
     servicedef.add_function(func);
   }
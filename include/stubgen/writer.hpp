@@ -50,20 +50,42 @@ class CppWriter : public AbstractWriter {
            << "using namespace JCONER;\n"
            << std::endl;
 
+      for(auto func = _servicedef._functions.begin(); func != _servicedef._functions.end(); func ++) {
+        if (func->is_async()) {
+          // async methods are coroutines
+          fout << "#ifndef JSONRPC_HAS_COROUTINES\n"
+               << "#error \"" << _spacename << " has async methods, compile with -std=c++20\"\n"
+               << "#endif\n"
+               << std::endl;
+          break;
+        }
+      }
+
       // class definition
       for(int i = 0; i < _classdefs.size(); i ++ ) {
         ClassDef def = _classdefs[i];
-        fout << "//Definition of class " << def._name << std::endl;
-        fout << "class "  << def._name << " {\n\n";
-        auto it = def._members.begin();
-        for(; it != def._members.end(); it ++) {
-          fout << "  " << it->second << " " << it->first<< ";\n";
-        }
-        fout << "\n\n";
-        fout << "//Define serializer\n";
-        fout << _get_indent(1) + "public:\n";
-        fout << _get_serializer(def._members); 
-        fout <<"\n\n};" << std::endl;
+        if (def.is_pod()) {
+          _write_pod_class(fout, def);
+        } else {
+          fout << "//Definition of class " << def._name << std::endl;
+          fout << "class "  << def._name << " {\n\n";
+          auto it = def._members.begin();
+          for(; it != def._members.end(); it ++) {
+            fout << "  " << it->second << " " << it->first<< ";\n";
+          }
+          if (def.is_columnar()) {
+            fout << "\n  friend class " << def.get_vector_name() << ";\n";
+          }
+          fout << "\n\n";
+          fout << "//Define serializer\n";
+          fout << _get_indent(1) + "public:\n";
+          fout << _get_serializer(def._members); 
+          fout <<"\n\n};" << std::endl;
+        }
+
+        if (def.is_columnar()) {
+          _write_columnar_vector(fout, def);
+        }
       }
 
       // protocol definition
@@ -87,8 +109,30 @@ class CppWriter : public AbstractWriter {
       fout << "class " << _get_service_name() << ": public "
            << BASE_SERVICE_NAME << "<" + _get_service_name() +"> {\n\n";
 
-      // wrappers 
+      // arguments of one call of a batchable function
       auto it = _servicedef._functions.begin();
+      bool batchable = false;
+      for(; it != _servicedef._functions.end(); it ++) {
+        if (!it->is_batchable()) {
+          continue;
+        }
+        if (!batchable) {
+          fout << _get_indent(1) + "public:\n";
+          batchable = true;
+        }
+        fout << _get_indent(2) + "struct " + it->get_name() + "Args {\n";
+        auto params = it->get_params();
+        for(auto param_it = params.begin(); param_it != params.end(); param_it ++) {
+          fout << _get_indent(3) + param_it->second + " " + param_it->first + ";\n";
+        }
+        fout << _get_indent(2) + "};\n\n";
+      }
+      if (batchable) {
+        fout << _get_indent(1) + "private:\n";
+      }
+
+      // wrappers 
+      it = _servicedef._functions.begin();
       for(int i = 0; i < _servicedef._functions.size(); i ++) {
         std::string name = _servicedef._functions[i].get_name();
         std::string wrapper_name = "_" + name + "_wrapper";
@@ -97,13 +141,42 @@ class CppWriter : public AbstractWriter {
         auto params = _servicedef._functions[i].get_params();
 
         fout << _get_indent(1) + "void " + wrapper_name + "(Request* req) {\n";
+        std::string cache_name = "_" + name + "_cache";
+        if (_servicedef._functions[i].is_cached()) {
+          // a hit is answered with the stored result text
+          fout << _get_indent(2) + "ResultCache::Key __key;\n";
+          fout << _get_indent(2) + "if (" + cache_name + ".lookup(*req, __key)) {\n";
+          fout << _get_indent(3) + "return;\n";
+          fout << _get_indent(2) + "}\n";
+        }
+        std::string coalescer_name = "_" + name + "_coalescer";
+        std::string run_name = "_" + name + "_run";
+        if (_servicedef._functions[i].is_coalesced()) {
+          // identical requests arriving meanwhile are parked on this one,
+          // the run itself goes in a method of its own so a waiting
+          // request can redo it if this one fails
+          fout << _get_indent(2) + "Coalescer::Flight __flight(" + coalescer_name +
+            ", *req, [this](Request* __req) { " + run_name + "(__req); });\n";
+          fout << _get_indent(2) + "if (__flight.joined()) {\n";
+          fout << _get_indent(3) + "return;\n";
+          fout << _get_indent(2) + "}\n";
+          fout << _get_indent(2) + run_name + "(req);\n";
+          if (_servicedef._functions[i].is_cached()) {
+            fout << _get_indent(2) + cache_name + ".store(__key, *req);\n";
+          }
+          fout << _get_indent(2) + "__flight.finish();\n";
+          fout << _get_indent(1) + "}\n\n";
+          fout << _get_indent(1) + "void " + run_name + "(Request* req) {\n";
+        }
 
         // body of wrapper
         std::string param_list_string = "";
         // if there are parameters
         if (params.size() != 0) {
 
-          fout << _get_indent(2) + "InSerializer& sin = req->get_serializer();\n";
+          if (params.size() > 1 || _servicedef._functions[i].get_upload() == "") {
+            fout << _get_indent(2) + "InSerializer& sin = req->get_serializer();\n";
+          }
 
           int count = 0;
           auto param_it = params.begin();
@@ -117,26 +190,79 @@ class CppWriter : public AbstractWriter {
               param_list_string += ", ";
             }
 
-            fout << _get_indent(2) + param_type + " " + param_name + ";\n";
-            fout << _get_indent(2) + "sin & " + param_name + ";\n";
+            if (ServiceDef::Function::is_upload_type(param_type)) {
+              // chunks are read while the method runs
+              fout << _get_indent(2) + "StreamReader<" +
+                ServiceDef::Function::upload_elem_type(param_type) + " > " + param_name + "(*req);\n";
+            } else {
+              fout << _get_indent(2) + param_type + " " + param_name + ";\n";
+              fout << _get_indent(2) + "sin & " + param_name + ";\n";
+            }
 
             count ++;
           }
           fout << "\n";
         }
 
-        if (_servicedef._functions[i].get_rettype() == "void") {
+        if (_servicedef._functions[i].is_async()) {
+          // the response goes out once the task finishes
+          fout << _get_indent(2) + "serve_task(req, " + name + "(" + param_list_string + "));\n";
+        } else if (_servicedef._functions[i].is_deferred()) {
+          // the responder takes the request over, the method may return
+          // before answering
+          std::string rettype = _servicedef._functions[i].get_rettype();
+          if (param_list_string != "") {
+            param_list_string += ", ";
+          }
+          fout << _get_indent(2) + name + "(" + param_list_string + "Responder<" + rettype +
+            " >(*req));\n";
+        } else if (_servicedef._functions[i].is_stream()) {
+          // elements go out through the writer while the method runs
+          std::string rettype = _servicedef._functions[i].get_rettype();
+          fout << _get_indent(2) + "StreamWriter<" + rettype + " > __w(req->get_response());\n";
+          if (param_list_string != "") {
+            param_list_string += ", ";
+          }
+          fout << _get_indent(2) + name + "(" + param_list_string + "__w);\n";
+        } else if (_servicedef._functions[i].get_rettype() == "void") {
           fout << _get_indent(2) + name + "(" + param_list_string + ");\n";
         } else {
           // if there is a return value
           std::string rettype = _servicedef._functions[i].get_rettype();
-          fout << _get_indent(2) + rettype + " __r = "
-               << name + "(" + param_list_string + ");\n";
+          if (_servicedef._functions[i].is_batchable()) {
+            // runs along with the calls arriving meanwhile, a call joining
+            // a batch is answered by the one that opened it
+            std::string args = "";
+            for(int k = 0; k < params.size(); k ++) {
+              args += (k == 0 ? "std::move(_arg" : ", std::move(_arg") + VarString::itos(k) + ")";
+            }
+            fout << _get_indent(2) + rettype + " __r;\n";
+            fout << _get_indent(2) + "if (!_" + name + "_batcher.submit(*req, " +
+              name + "Args{" + args + "}, __r)) {\n";
+            fout << _get_indent(3) + "return;\n";
+            fout << _get_indent(2) + "}\n";
+          } else {
+            fout << _get_indent(2) + rettype + " __r = "
+                 << name + "(" + param_list_string + ");\n";
+          }
           fout << _get_indent(2) + 
             "OutSerializer& sout = req->get_response().get_serializer();\n";
           fout << _get_indent(2) + "sout & __r;\n";
+          if (_servicedef._functions[i].is_cached() && !_servicedef._functions[i].is_coalesced()) {
+            fout << _get_indent(2) + cache_name + ".store(__key, *req);\n";
+          }
         }
         fout << _get_indent(1) + "}\n\n";
+        if (_servicedef._functions[i].is_cached()) {
+          fout << _get_indent(1) + "ResultCache " + cache_name + ";\n\n";
+        }
+        if (_servicedef._functions[i].is_coalesced()) {
+          fout << _get_indent(1) + "Coalescer " + coalescer_name + ";\n\n";
+        }
+        if (_servicedef._functions[i].is_batchable()) {
+          fout << _get_indent(1) + "Batcher<" + name + "Args, " +
+            _servicedef._functions[i].get_rettype() + " > _" + name + "_batcher;\n\n";
+        }
       }
 
       fout << "\n\n";
@@ -146,7 +272,21 @@ class CppWriter : public AbstractWriter {
       // constructor
       fout << _get_indent(2) + _get_service_name() + "(" + BASE_SERVER_CONNECTOR
         + "& server):" + BASE_SERVICE_NAME + "<" + _get_service_name() + ">"
-        + "(server) {\n";
+        + "(server)";
+      it = _servicedef._functions.begin();
+      for(; it != _servicedef._functions.end(); it ++) {
+        if (it->is_cached()) {
+          fout << ",\n" + _get_indent(4) + "_" + it->get_name() + "_cache(" +
+            VarString::itos(it->cache_ttl_ms()) + ", " + VarString::itos(it->cache_entries()) + ")";
+        }
+        if (it->is_batchable()) {
+          fout << ",\n" + _get_indent(4) + "_" + it->get_name() + "_batcher(" +
+            VarString::itos(it->batch_window_us()) + ", " + VarString::itos(it->batch_max()) +
+            ", [this](std::vector<" + it->get_name() + "Args>& calls) { return " +
+            it->get_name() + "Batch(calls); }, [&server] { return server.idle(); })";
+        }
+      }
+      fout << " {\n";
       fout << _get_indent(3) + "register_service();\n";
       fout << _get_indent(2) + "}\n\n";
 
@@ -162,9 +302,37 @@ class CppWriter : public AbstractWriter {
 
       it = _servicedef._functions.begin();
       for(; it != _servicedef._functions.end(); it ++) {
-        fout << _get_indent(2) + "virtual " << it->get_declaration() << "{\n"
+        std::string writer = "";
+        if (it->is_stream()) {
+          writer = "StreamWriter<" + it->get_rettype() + " >& writer";
+        }
+        std::string decl = it->get_declaration(false, writer);
+        if (it->is_async()) {
+          decl = it->get_task_declaration();
+        } else if (it->is_deferred()) {
+          decl = it->get_deferred_declaration();
+        }
+        fout << _get_indent(2) + "virtual " << decl << "{\n"
              << _get_indent(3) + "//TODO: stub HERE\n"
              << _get_indent(2) + "}\n";
+
+        if (it->is_batchable()) {
+          // one call at a time unless the service answers a batch at once
+          std::string rettype = it->get_rettype();
+          std::string call = "";
+          auto params = it->get_params();
+          for(auto param_it = params.begin(); param_it != params.end(); param_it ++) {
+            call += (call == "" ? "calls[__i]." : ", calls[__i].") + param_it->first;
+          }
+          fout << _get_indent(2) + "virtual std::vector<" + rettype + " > " + it->get_name() +
+                  "Batch(std::vector<" + it->get_name() + "Args>& calls) {\n"
+               << _get_indent(3) + "std::vector<" + rettype + " > results;\n"
+               << _get_indent(3) + "for(size_t __i = 0; __i < calls.size(); __i ++) {\n"
+               << _get_indent(4) + "results.push_back(" + it->get_name() + "(" + call + "));\n"
+               << _get_indent(3) + "}\n"
+               << _get_indent(3) + "return results;\n"
+               << _get_indent(2) + "}\n";
+        }
       }
 
       fout << "\n\n};\n";
@@ -177,39 +345,145 @@ class CppWriter : public AbstractWriter {
       fout << _get_indent(1) << "public:\n";
 
       fout << _get_indent(2) + _get_client_name()  + "(" + BASE_CLIENT_CONNECTOR + "& client) : "
-        + BASE_CLIENT_NAME + "(client) {}\n";
+        + BASE_CLIENT_NAME + "(client)";
+      it = _servicedef._functions.begin();
+      for(; it != _servicedef._functions.end(); it ++) {
+        if (it->is_client_cached()) {
+          fout << ",\n" + _get_indent(4) + "_" + it->get_name() + "_cache(" +
+            VarString::itos(it->client_ttl_ms()) + ", " + VarString::itos(it->client_entries()) + ")";
+        }
+      }
+      fout << " {}\n";
 
       it = _servicedef._functions.begin();
       int count = 0;
       for(; it != _servicedef._functions.end(); it ++) {
-        fout << _get_indent(2) + "virtual " << it->get_declaration() << " {\n";
+        std::string callback = "";
+        if (it->is_stream()) {
+          callback = "std::function<void(" + it->get_rettype() + "&)> on_item";
+        }
+        fout << _get_indent(2) + "virtual " << it->get_declaration(false, callback, true) << " {\n";
+        if (_uses_attachments(*it)) {
+          // Bytes and NumArray arguments go to the raw section built here
+          fout << _get_indent(3) + "AttachmentScope __att;\n";
+        }
+        auto param_map = it->get_params();
+        std::string upload = it->get_upload();
+        std::string rettype = it->get_rettype();
+
+        if (!it->is_stream() && upload == "") {
+          // plain calls encode their arguments straight into the request
+          // cached calls are keyed on the request text, so never direct
+          fout << _get_indent(3) + "RequestEncoder __req = begin_request(" + _get_protocol_name() +
+            "::" + func_upper_names[count] + (it->is_client_cached() ? ", false);\n" : ");\n");
+          std::for_each(param_map.begin(), param_map.end(),
+              [&] (typename std::map<std::string, std::string>::value_type a) {
+                fout << _get_indent(3) + "__req.arg(" + a.first + ");\n";
+              }
+          );
+          if (it->is_client_cached()) {
+            fout << _get_indent(3) + "return _" + it->get_name() +
+              "_cache.get(__req.cache_key(AttachmentScope::outgoing()),\n";
+            fout << _get_indent(5) + "[&](" + rettype + "& __r) { call(__req, &__r); });\n";
+          } else if (rettype != "void") {
+            fout << _get_indent(3)  + rettype + " __r;\n";
+            fout << _get_indent(3) + "call(__req, &__r);\n";
+            fout << _get_indent(3) + "return __r;\n";
+          } else {
+            fout << _get_indent(3) + "call(__req);\n";
+          }
+          fout << _get_indent(2) + "}\n\n";
+          count ++;
+          continue;
+        }
+
         fout << _get_indent(3) + "OutSerializer sout;\n";
         
-        auto param_map = it->get_params();
         std::for_each(param_map.begin(), param_map.end(), 
             [&] (typename std::map<std::string, std::string>::value_type a) {
-              fout << _get_indent(3) + "sout & " + a.first + ";\n";
+              if (a.first != upload) {
+                fout << _get_indent(3) + "sout & " + a.first + ";\n";
+              }
             }
         );
-        std::string rettype = it->get_rettype();
-        if (rettype != "void") {
+        if (rettype != "void" && !it->is_stream()) {
           fout << _get_indent(3)  + rettype + " __r;\n";
         }
 
 
-        if (rettype != "void") {
-          fout << _get_indent(3) + "call(" + _get_protocol_name() +  "::" +
-            func_upper_names[count] + ", sout, &__r);\n";
-          fout << _get_indent(3) + "return __r;\n";
+        if (it->is_stream()) {
+          fout << _get_indent(3) + "call_stream(" + _get_protocol_name() +  "::" +
+            func_upper_names[count] + ", sout, on_item);\n";
         } else {
-          fout << _get_indent(3) + "call(" + _get_protocol_name() + "::" +
-            func_upper_names[count] + ", sout);\n";
+          fout << _get_indent(3) + "call_upload(" + _get_protocol_name() +  "::" +
+            func_upper_names[count] + ", sout, " + upload +
+            (rettype != "void" ? ", &__r);\n" : ");\n");
+          if (rettype != "void") {
+            fout << _get_indent(3) + "return __r;\n";
+          }
         }
 
         fout << _get_indent(2) + "}\n\n"; 
         count ++;
       }
 
+      // co_await-able calls, the plain ones that aren't cached
+      bool coroutines = false;
+      count = 0;
+      it = _servicedef._functions.begin();
+      for(; it != _servicedef._functions.end(); it ++, count ++) {
+        if (it->is_stream() || it->get_upload() != "" || it->is_client_cached()) {
+          continue;
+        }
+        if (!coroutines) {
+          fout << "#ifdef JSONRPC_HAS_COROUTINES\n";
+          coroutines = true;
+        }
+        std::string rettype = it->get_rettype();
+        auto param_map = it->get_params();
+        fout << _get_indent(2) + "virtual " << it->get_task_declaration("co_", true) << " {\n";
+        // the request is encoded before the coroutine suspends, attachment
+        // scopes don't outlive a suspension
+        fout << _get_indent(3) + "std::string __msg;\n";
+        fout << _get_indent(3) + "{\n";
+        if (_uses_attachments(*it)) {
+          fout << _get_indent(4) + "AttachmentScope __att;\n";
+        }
+        fout << _get_indent(4) + "RequestEncoder __req = begin_request(" + _get_protocol_name() +
+          "::" + func_upper_names[count] + ", false);\n";
+        std::for_each(param_map.begin(), param_map.end(),
+            [&] (typename std::map<std::string, std::string>::value_type a) {
+              fout << _get_indent(4) + "__req.arg(" + a.first + ");\n";
+            }
+        );
+        fout << _get_indent(4) + "__msg = __req.finish(AttachmentScope::outgoing());\n";
+        fout << _get_indent(3) + "}\n";
+        if (rettype != "void") {
+          fout << _get_indent(3) + rettype + " __r;\n";
+          fout << _get_indent(3) + "co_await call_async(std::move(__msg), &__r);\n";
+          fout << _get_indent(3) + "co_return __r;\n";
+        } else {
+          fout << _get_indent(3) + "co_await call_async(std::move(__msg));\n";
+        }
+        fout << _get_indent(2) + "}\n\n";
+      }
+      if (coroutines) {
+        fout << "#endif\n";
+      }
+
+      bool client_cached = false;
+      it = _servicedef._functions.begin();
+      for(; it != _servicedef._functions.end(); it ++) {
+        if (it->is_client_cached()) {
+          if (!client_cached) {
+            fout << _get_indent(1) << "private:\n";
+            client_cached = true;
+          }
+          fout << _get_indent(2) + "ClientCache<" + it->get_rettype() + " > _" +
+            it->get_name() + "_cache;\n";
+        }
+      }
+
       fout << "\n\n};\n";
 
 
@@ -251,6 +525,15 @@ class CppWriter : public AbstractWriter {
         _get_indent(3) +   "void seralize(Serializer& serializer) {\n";
       auto it = variables.begin();
       for(; it != variables.end(); it ++ ) {
+        std::string elem;
+        size_t count;
+        if (ClassDef::array_type(it->second, elem, count)) {
+          // a std::array goes element by element
+          pattern +=
+           _get_indent(4) + "for(size_t __i = 0; __i < " + VarString::itos(count) + "; __i ++) " +
+           "serializer & " + it->first + "[__i];\n";
+          continue;
+        }
         pattern += 
          _get_indent(4) + "serializer & " + it->first + ";\n";
       }
@@ -259,6 +542,177 @@ class CppWriter : public AbstractWriter {
       return pattern;
     }
 
+    /* A class made of fixed width scalars. Members are declared widest
+     * first, so the layout has no holes, and the layout is checked at
+     * compile time. Vectors of it can go out as one memcpy, see PodArray.
+     */
+    void _write_pod_class(std::ofstream& fout, ClassDef& def) {
+      std::vector<std::pair<std::string, size_t> > offsets;
+      size_t size = def.pod_layout(offsets);
+      std::string size_text = VarString::itos(size);
+
+      fout << "//Definition of class " << def._name << ", fixed layout of "
+           << size_text << " bytes" << std::endl;
+      fout << "class "  << def._name << " {\n\n";
+      size_t end = 0;
+      for(size_t i = 0; i < offsets.size(); i ++) {
+        size_t member_size, align;
+        ClassDef::pod_type(def._members[offsets[i].first], member_size, align);
+        fout << "  " << def._members[offsets[i].first] << " " << offsets[i].first << ";\n";
+        end = offsets[i].second + member_size;
+      }
+      if (end < size) {
+        fout << "  uint8_t __pad[" << VarString::itos(size - end) << "];\n";
+      }
+      if (def.is_columnar()) {
+        fout << "\n  friend class " << def.get_vector_name() << ";\n";
+      }
+      fout << "\n\n";
+      fout << "//Define serializer\n";
+      fout << _get_indent(1) + "public:\n";
+      if (end < size) {
+        // the padding goes out with the memcpy, so keep it zero
+        fout << _get_indent(2) + def._name + "() { memset((void*)this, 0, sizeof(*this)); }\n\n";
+      }
+      fout << _get_serializer(def._members);
+
+      fout << "\n" + _get_indent(2) + "// swap the byte order of every field\n";
+      fout << _get_indent(2) + "void byteswap() {\n";
+      auto it = def._members.begin();
+      for(; it != def._members.end(); it ++) {
+        fout << _get_indent(3) + "pod::byteswap(" + it->first + ");\n";
+      }
+      fout << _get_indent(2) + "}\n";
+
+      fout << "\n" + _get_indent(1) + "private:\n";
+      fout << _get_indent(2) + "static void _check_layout() {\n";
+      fout << _get_indent(3) + "static_assert(sizeof(" + def._name + ") == " + size_text +
+        ", \"" + def._name + " has to be " + size_text + " bytes\");\n";
+      for(size_t i = 0; i < offsets.size(); i ++) {
+        std::string offset = VarString::itos(offsets[i].second);
+        fout << _get_indent(3) + "static_assert(offsetof(" + def._name + ", " + offsets[i].first +
+          ") == " + offset + ", \"" + offsets[i].first + " has to be at " + offset + "\");\n";
+      }
+      fout << _get_indent(2) + "}\n";
+      fout << "\n\n};" << std::endl;
+    }
+
+    /* Vector of a columnar class. It goes out as [names, column, ...], one
+     * array per member with the member names written once, and is rebuilt
+     * from the columns.
+     */
+    void _write_columnar_vector(std::ofstream& fout, ClassDef& def) {
+      std::string name = def.get_vector_name();
+      std::string base = "std::vector<" + def._name + ">";
+
+      std::string names = "";
+      auto it = def._columns.begin();
+      for(; it != def._columns.end(); it ++) {
+        if (names != "") names += ", ";
+        names += "\"" + it->first + "\"";
+      }
+
+      fout << "//Vector of " << def._name << ", sent column by column\n";
+      fout << "class " << name << " : public " << base << " {\n";
+      fout << _get_indent(1) + "public:\n";
+      fout << _get_indent(2) + "using " + base + "::vector;\n\n";
+      fout << _get_indent(2) + name + "() {}\n";
+      fout << _get_indent(2) + name + "(const " + base + "& v) : " + base + "(v) {}\n";
+      fout << _get_indent(2) + name + "(" + base + "&& v) : " + base + "(std::move(v)) {}\n\n";
+
+      fout << _get_indent(2) + "static const std::vector<std::string>& column_names() {\n";
+      fout << _get_indent(3) + "static const std::vector<std::string> names = {" + names + "};\n";
+      fout << _get_indent(3) + "return names;\n";
+      fout << _get_indent(2) + "}\n\n";
+
+      fout << _get_indent(2) + "void seralize(OutSerializer& serializer) {\n";
+      fout << _get_indent(3) + "std::vector<std::string> __names = column_names();\n";
+      fout << _get_indent(3) + "serializer & __names;\n";
+      for(it = def._columns.begin(); it != def._columns.end(); it ++) {
+        fout << _get_indent(3) + "{\n";
+        fout << _get_indent(4) + it->second + " __col;\n";
+        fout << _get_indent(4) + "__col.reserve(size());\n";
+        fout << _get_indent(4) + "for(size_t __i = 0; __i < size(); __i ++) " +
+          "__col.push_back((*this)[__i]." + it->first + ");\n";
+        fout << _get_indent(4) + "serializer & __col;\n";
+        fout << _get_indent(3) + "}\n";
+      }
+      fout << _get_indent(2) + "}\n\n";
+
+      fout << _get_indent(2) + "void seralize(InSerializer& serializer) {\n";
+      fout << _get_indent(3) + "std::vector<std::string> __names;\n";
+      fout << _get_indent(3) + "serializer & __names;\n";
+      fout << _get_indent(3) + "if (__names != column_names()) {\n";
+      fout << _get_indent(4) + "throw SerializeFailException();\n";
+      fout << _get_indent(3) + "}\n";
+      bool first = true;
+      for(it = def._columns.begin(); it != def._columns.end(); it ++) {
+        fout << _get_indent(3) + "{\n";
+        fout << _get_indent(4) + it->second + " __col;\n";
+        fout << _get_indent(4) + "serializer & __col;\n";
+        if (first) {
+          fout << _get_indent(4) + "resize(__col.size());\n";
+          first = false;
+        } else {
+          fout << _get_indent(4) + "if (__col.size() != size()) {\n";
+          fout << _get_indent(5) + "throw SerializeFailException();\n";
+          fout << _get_indent(4) + "}\n";
+        }
+        fout << _get_indent(4) + "for(size_t __i = 0; __i < size(); __i ++) " +
+          "(*this)[__i]." + it->first + " = std::move(__col[__i]);\n";
+        fout << _get_indent(3) + "}\n";
+      }
+      fout << _get_indent(2) + "}\n";
+      fout << "};\n\n";
+    }
+
+    /* Check if a value of type has parts in the attachment section, Bytes,
+     * NumArray or PodArray, directly or in a member
+     */
+    bool _uses_attachments(const std::string& type, int depth = 0) {
+      if (ClassDef::refers_to(type, "Bytes") || ClassDef::refers_to(type, "NumArray") ||
+          ClassDef::refers_to(type, "PodArray")) {
+        return true;
+      }
+      if (depth > 16) {
+        return false;
+      }
+
+      for(int i = 0; i < _classdefs.size(); i ++) {
+        if (!ClassDef::refers_to(type, _classdefs[i]._name) &&
+            !(_classdefs[i].is_columnar() &&
+              ClassDef::refers_to(type, _classdefs[i].get_vector_name()))) {
+          continue;
+        }
+        auto it = _classdefs[i]._members.begin();
+        for(; it != _classdefs[i]._members.end(); it ++) {
+          if (_uses_attachments(it->second, depth + 1)) {
+            return true;
+          }
+        }
+        // the columns of a columnar vector can be NumArray
+        for(it = _classdefs[i]._columns.begin(); it != _classdefs[i]._columns.end(); it ++) {
+          if (_uses_attachments(it->second, depth + 1)) {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    bool _uses_attachments(const ServiceDef::Function& func) {
+      if (_uses_attachments(func.get_rettype())) {
+        return true;
+      }
+      auto it = func.get_params().begin();
+      for(; it != func.get_params().end(); it ++) {
+        if (_uses_attachments(it->second)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
     std::vector<ClassDef>& _classdefs;
     ServiceDef& _servicedef;
 };
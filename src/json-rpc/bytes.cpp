@@ -0,0 +1,98 @@
+#include "json-rpc/bytes.hpp"
+
+static thread_local AttachmentScope* current_scope = nullptr;
+
+AttachmentScope::AttachmentScope()
+    : _in(nullptr), _out(&_own), _prev(current_scope) {
+  current_scope = this;
+}
+
+AttachmentScope::AttachmentScope(const std::string* in, std::string* out)
+    : _in(in), _out(out), _prev(current_scope) {
+  current_scope = this;
+}
+
+AttachmentScope::~AttachmentScope() {
+  current_scope = _prev;
+}
+
+AttachmentScope* AttachmentScope::current() {
+  return current_scope;
+}
+
+const std::string& AttachmentScope::outgoing() {
+  static const std::string none;
+  if (current_scope == nullptr || current_scope->_out != &current_scope->_own) {
+    return none;
+  }
+  return current_scope->_own;
+}
+
+size_t AttachmentScope::append(const char* data, size_t len) {
+  size_t offset = _out->size();
+  _out->append(data, len);
+  return offset;
+}
+
+bool AttachmentScope::fetch(size_t offset, size_t len, std::string& value) const {
+  const char* data = view(offset, len);
+  if (data == nullptr) {
+    return false;
+  }
+  value.assign(data, len);
+  return true;
+}
+
+const char* AttachmentScope::view(size_t offset, size_t len) const {
+  if (_in == nullptr || offset > _in->size() || len > _in->size() - offset) {
+    return nullptr;
+  }
+  return _in->data() + offset;
+}
+
+void Bytes::seralize(OutSerializer& serializer) {
+  AttachmentScope* scope = AttachmentScope::current();
+  if (scope == nullptr || !scope->writable()) {
+    throw SerializeFailException();
+  }
+
+  long offset = scope->append(_data.data(), _data.size());
+  long len = _data.size();
+  serializer & offset;
+  serializer & len;
+}
+
+void Bytes::seralize(InSerializer& serializer) {
+  long offset = 0;
+  long len = 0;
+  serializer & offset;
+  serializer & len;
+
+  AttachmentScope* scope = AttachmentScope::current();
+  if (scope == nullptr || offset < 0 || len < 0 || !scope->fetch(offset, len, _data)) {
+    throw SerializeFailException();
+  }
+}
+
+std::string split_frame(const std::string& frame, std::string* attachments) {
+  // json text never holds a raw '\0', the first one ends it
+  size_t end = frame.find('\0');
+  if (end == std::string::npos) {
+    if (attachments) attachments->clear();
+    return frame;
+  }
+
+  if (attachments) {
+    attachments->assign(frame, end + 1, std::string::npos);
+  }
+  return frame.substr(0, end);
+}
+
+void join_frame(std::string& json, const std::string& attachments) {
+  if (attachments.empty()) {
+    return;
+  }
+  json.reserve(json.size() + 1 + attachments.size());
+  json.push_back('\0');
+  json.append(attachments);
+}
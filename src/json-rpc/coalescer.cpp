@@ -0,0 +1,108 @@
+#include "json-rpc/server/coalescer.hpp"
+
+#include "json-rpc/bytes.hpp"
+
+Coalescer::Flight::Flight(Coalescer& coalescer, Request& req, Rerun rerun)
+    : _coalescer(coalescer), _req(req), _hash(0), _joined(false), _leader(false),
+      _finished(false) {
+  // only requests that came as text can be compared
+  if (req.raw_params_size() == 0) {
+    return;
+  }
+
+  _hash = req.raw_hash();
+  std::lock_guard<std::mutex> _(coalescer._mutex);
+  auto it = coalescer._runs.find(_hash);
+  if (it == coalescer._runs.end()) {
+    std::shared_ptr<Run> run(new Run());
+    run->method = req.handlerid();
+    run->params.assign(req.raw_params(), req.raw_params_size());
+    run->attachments = req.attachments();
+    run->rerun = rerun;
+    coalescer._runs[_hash] = run;
+    _leader = true;
+    return;
+  }
+
+  std::shared_ptr<Run> run = it->second;
+  if (run->method != req.handlerid() ||
+      run->params.compare(0, std::string::npos, req.raw_params(), req.raw_params_size()) != 0 ||
+      run->attachments != req.attachments()) {
+    // same hash, different request, run on its own
+    return;
+  }
+  if (!req.can_defer() || req.upload()) {
+    // would hold its worker waiting, run on its own
+    return;
+  }
+
+  run->waiters.push_back(req.defer());
+  _joined = true;
+}
+
+Coalescer::Flight::~Flight() {
+  if (_leader && !_finished) {
+    _coalescer._end(_hash, _req, false);
+  }
+}
+
+void Coalescer::Flight::finish() {
+  if (_leader && !_finished) {
+    _finished = true;
+    _coalescer._end(_hash, _req, true);
+  }
+}
+
+size_t Coalescer::waiting() {
+  std::lock_guard<std::mutex> _(_mutex);
+  size_t count = 0;
+  for(auto it = _runs.begin(); it != _runs.end(); it ++) {
+    count += it->second->waiters.size();
+  }
+  return count;
+}
+
+void Coalescer::_end(uint64_t hash, Request& req, bool ok) {
+  std::shared_ptr<Run> run;
+  {
+    std::lock_guard<std::mutex> _(_mutex);
+    auto it = _runs.find(hash);
+    if (it == _runs.end()) {
+      return;
+    }
+    run = it->second;
+    _runs.erase(it);
+  }
+
+  std::vector<std::shared_ptr<Request> >& waiters = run->waiters;
+  size_t first = 0;
+  Request* done = ok ? &req : nullptr;
+  while (!done && first < waiters.size()) {
+    // the run failed, the next waiting request runs it
+    Request* next = waiters[first ++].get();
+    try {
+      // the sections of next, not of the failed request
+      AttachmentScope scope(&next->attachments(), &next->get_response().attachments());
+      run->rerun(next);
+      done = next;
+    } catch(...) {
+      next->complete(std::current_exception());
+    }
+  }
+  if (!done) {
+    return;
+  }
+
+  // encoded once here, every waiting request sends the same text
+  std::shared_ptr<const std::string> result = done->get_response().encode_result();
+  std::string attachments = done->get_response().attachments();
+  if (done != &req) {
+    done->complete();
+  }
+  for(size_t i = first; i < waiters.size(); i ++) {
+    Response& resp = waiters[i]->get_response();
+    resp.set_raw_result(result);
+    resp.attachments() = attachments;
+    waiters[i]->complete();
+  }
+}
@@ -0,0 +1,155 @@
+#include "json-rpc/server/dedup.hpp"
+
+#include <chrono>
+
+DedupTable::DedupTable(size_t capacity, long window_ms)
+    : _capacity(capacity == 0 ? 1 : capacity), _window_ms(window_ms), _seq(0) {
+}
+
+DedupTable::Claim DedupTable::claim(int clientno, int messageid, size_t method, long timestamp,
+                                    uint64_t params, std::string& response, Request* request) {
+  Key key = _key(clientno, messageid);
+  std::unique_lock<std::mutex> lock(_mutex);
+  _evict(_now_ms());
+
+  while (true) {
+    auto it = _entries.find(key);
+    if (it != _entries.end() &&
+        (it->second.method != method || it->second.timestamp != timestamp ||
+         it->second.params != params)) {
+      if (!it->second.done) {
+        // an unrelated request with the same numbers is running, leave it be
+        // and don't track this one
+        return RUN;
+      }
+      _entries.erase(it);
+      it = _entries.end();
+    }
+
+    if (it == _entries.end()) {
+      Entry& entry = _entries[key];
+      entry.method = method;
+      entry.timestamp = timestamp;
+      entry.params = params;
+      entry.seq = ++ _seq;
+      entry.done = false;
+      entry.stored_at = 0;
+      entry.response.reset();
+      entry.parked.clear();
+      entry.cond.reset();
+      _order.push_back(std::make_pair(key, entry.seq));
+      return RUN;
+    }
+
+    Entry& entry = it->second;
+    if (entry.done) {
+      response = *entry.response;
+      return ANSWERED;
+    }
+
+    // the first copy is still running, its response answers this one too
+    if (request != nullptr && request->can_defer() && !request->upload()) {
+      entry.parked.push_back(request->defer());
+      return PARKED;
+    }
+    if (!entry.cond) {
+      entry.cond.reset(new std::condition_variable());
+    }
+    std::shared_ptr<std::condition_variable> cond = entry.cond;
+    cond->wait(lock);
+  }
+}
+
+void DedupTable::finish(int clientno, int messageid, size_t method, long timestamp,
+                        uint64_t params, const char* response, size_t len) {
+  std::shared_ptr<const std::string> text(new std::string(response, len));
+  std::vector<std::shared_ptr<Request> > parked;
+  {
+    std::lock_guard<std::mutex> _(_mutex);
+    Entry* entry = _find(clientno, messageid, method, timestamp, params);
+    if (entry == nullptr) {
+      return;
+    }
+    entry->done = true;
+    entry->stored_at = _now_ms();
+    entry->response = text;
+    parked.swap(entry->parked);
+    if (entry->cond) {
+      entry->cond->notify_all();
+      entry->cond.reset();
+    }
+  }
+
+  for(size_t i = 0; i < parked.size(); i ++) {
+    parked[i]->get_response().set_raw_frame(text);
+    parked[i]->complete();
+  }
+}
+
+std::vector<std::shared_ptr<Request> > DedupTable::abandon(int clientno, int messageid,
+                                                           size_t method, long timestamp,
+                                                           uint64_t params) {
+  std::vector<std::shared_ptr<Request> > parked;
+  std::lock_guard<std::mutex> _(_mutex);
+  Entry* entry = _find(clientno, messageid, method, timestamp, params);
+  if (entry == nullptr) {
+    return parked;
+  }
+  parked.swap(entry->parked);
+  if (entry->cond) {
+    entry->cond->notify_all();
+  }
+  _entries.erase(_key(clientno, messageid));
+  return parked;
+}
+
+size_t DedupTable::size() {
+  std::lock_guard<std::mutex> _(_mutex);
+  return _entries.size();
+}
+
+uint64_t DedupTable::_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* The running entry of a claimed request, nullptr if it is gone */
+DedupTable::Entry* DedupTable::_find(int clientno, int messageid, size_t method, long timestamp,
+                                     uint64_t params) {
+  auto it = _entries.find(_key(clientno, messageid));
+  if (it == _entries.end() || it->second.done ||
+      it->second.method != method || it->second.timestamp != timestamp ||
+      it->second.params != params) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+/* Drop answered entries past the window, and the oldest answered ones while
+ * the table is full. Running entries stay, they go to the back of the line.
+ */
+void DedupTable::_evict(uint64_t now) {
+  size_t budget = _order.size();
+  while (!_order.empty() && budget -- > 0) {
+    std::pair<Key, uint64_t> front = _order.front();
+    auto it = _entries.find(front.first);
+    if (it == _entries.end() || it->second.seq != front.second) {
+      _order.pop_front();
+      continue;
+    }
+
+    Entry& entry = it->second;
+    bool full = _entries.size() >= _capacity;
+    if (!entry.done) {
+      if (!full) break;
+      _order.pop_front();
+      _order.push_back(front);
+      continue;
+    }
+    if (!full && (long)(now - entry.stored_at) < _window_ms) {
+      break;
+    }
+    _entries.erase(it);
+    _order.pop_front();
+  }
+}
@@ -0,0 +1,69 @@
+#include "json-rpc/client/encoder.hpp"
+#include "json-rpc/proto.hpp"
+
+// the envelope up to each value, in the order Proto::build_request puts it
+static const std::string ClientNoPrefix = "{\"" + ClientNo + "\":";
+static const std::string ServerNoPrefix = ",\"" + ServerNo + "\":0,\"" + Version + "\":1,\"" +
+                                          Timestamp + "\":";
+static const std::string MessageIdPrefix = ",\"" + MessageId + "\":";
+static const std::string MethodPrefix = ",\"" + Method + "\":";
+static const std::string ParamPrefix = ",\"" + Param + "\":[";
+
+RequestEncoder::RequestEncoder(int clientno, int messageid, long timestamp,
+                               size_t method_hash, bool direct)
+    : _clientno(clientno), _messageid(messageid), _timestamp(timestamp),
+      _method_hash(method_hash), _params_at(0), _count(0) {
+  if (direct) {
+    _sout.reset(new OutSerializer());
+    return;
+  }
+
+  _text.reserve(128);
+  _text.append(ClientNoPrefix);
+  numeric::append(_text, (long long)clientno);
+  _text.append(ServerNoPrefix);
+  numeric::append(_text, (long long)timestamp);
+  _text.append(MessageIdPrefix);
+  numeric::append(_text, (long long)messageid);
+  _text.append(MethodPrefix);
+  numeric::append(_text, (long long)method_hash);
+  _text.append(ParamPrefix);
+  _params_at = _text.size();
+}
+
+std::string RequestEncoder::cache_key(const std::string& attachments) const {
+  if (_sout) {
+    return std::string();
+  }
+  std::string key(_text, _params_at, std::string::npos);
+  key.push_back('\0');
+  key.append(attachments);
+  return key;
+}
+
+std::string RequestEncoder::finish(const std::string& attachments) {
+  if (_sout) {
+    return Proto::build_request(_clientno, 0, _messageid, _timestamp, _method_hash, *_sout,
+                                false, attachments);
+  }
+
+  _text.append("]}", 2);
+  join_frame(_text, attachments);
+  return std::move(_text);
+}
+
+void RequestEncoder::_value(const Bytes& value) {
+  AttachmentScope* scope = AttachmentScope::current();
+  if (scope == nullptr || !scope->writable()) {
+    throw SerializeFailException();
+  }
+  _reference(scope->append(value.data(), value.size()), value.size());
+}
+
+void RequestEncoder::_reference(size_t offset, size_t len) {
+  _text.push_back('[');
+  numeric::append(_text, (long long)offset);
+  _text.push_back(',');
+  numeric::append(_text, (long long)len);
+  _text.push_back(']');
+}
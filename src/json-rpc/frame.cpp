@@ -0,0 +1,237 @@
+#include "json-rpc/frame.hpp"
+#include "json-rpc/numarray.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
+
+FramePool FramePool::_instance;
+
+FramePool::~FramePool() {
+  for(size_t i = 0; i < _free.size(); i ++) {
+    delete _free[i];
+  }
+  _free.clear();
+}
+
+FrameBuffer* FramePool::acquire() {
+  {
+    ScopeLock _(&_mutex);
+    if (!_free.empty()) {
+      FrameBuffer* frame = _free.back();
+      _free.pop_back();
+      return frame;
+    }
+  }
+  return new FrameBuffer();
+}
+
+void FramePool::release(FrameBuffer* frame) {
+  if (frame == nullptr) {
+    return;
+  }
+
+  if (frame->capacity() <= MAX_POOLED_CAPACITY) {
+    frame->clear();
+    ScopeLock _(&_mutex);
+    if (_free.size() < MAX_POOLED) {
+      _free.push_back(frame);
+      return;
+    }
+  }
+  delete frame;
+}
+
+namespace {
+
+inline void put(FrameBuffer& out, const char* data, size_t len) { out.append(data, len); }
+inline void put(std::string& out, const char* data, size_t len) { out.append(data, len); }
+
+template<class Out>
+void write_string(Out& out, const char* str, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+
+  out.push_back('"');
+  const char* p = str;
+  const char* end = p + len;
+  const char* run = p;
+  for(; p < end; p ++) {
+    unsigned char c = *p;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    // copy the plain characters before c in one go
+    put(out, run, p - run);
+    run = p + 1;
+
+    out.push_back('\\');
+    switch(c) {
+      case '"':  out.push_back('"'); break;
+      case '\\': out.push_back('\\'); break;
+      case '\b': out.push_back('b'); break;
+      case '\f': out.push_back('f'); break;
+      case '\n': out.push_back('n'); break;
+      case '\r': out.push_back('r'); break;
+      case '\t': out.push_back('t'); break;
+      default: {
+        char esc[5] = {'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+        put(out, esc, sizeof(esc));
+      }
+    }
+  }
+  put(out, run, p - run);
+  out.push_back('"');
+}
+
+template<class Out>
+void write_string(Out& out, const std::string& str) {
+  write_string(out, str.data(), str.size());
+}
+
+/* numeric::append, and a ".0" so a whole real reads back as a real */
+void append_real(std::string& out, double value) {
+  size_t start = out.size();
+  numeric::append(out, value);
+  if (out.find_first_of(".eE", start) == std::string::npos) {
+    out.append(".0");
+  }
+}
+
+template<class Out>
+void write_value(Out& out, JValue* value) {
+  // numbers go through the numeric codec, which needs a string to append to
+  static thread_local std::string number;
+
+  if (value == nullptr || value->isNull()) {
+    put(out, "null", 4);
+  } else if (value->isObject()) {
+    out.push_back('{');
+    std::vector<std::string> keys = value->getKeys();
+    for(size_t i = 0; i < keys.size(); i ++) {
+      if (i != 0) out.push_back(',');
+      write_string(out, keys[i]);
+      out.push_back(':');
+      write_value(out, value->get(keys[i]));
+    }
+    out.push_back('}');
+  } else if (value->isArray()) {
+    out.push_back('[');
+    int size = value->size();
+    for(int i = 0; i < size; i ++) {
+      if (i != 0) out.push_back(',');
+      write_value(out, value->get(i));
+    }
+    out.push_back(']');
+  } else if (value->isString()) {
+    write_string(out, value->getString());
+  } else if (value->isInteger()) {
+    number.clear();
+    numeric::append(number, (long long)value->getInteger());
+    put(out, number.data(), number.size());
+  } else if (value->isReal()) {
+    double real = value->getReal();
+    if (!std::isfinite(real)) {
+      // json has no inf or nan
+      put(out, "null", 4);
+      return;
+    }
+    number.clear();
+    append_real(number, real);
+    put(out, number.data(), number.size());
+  } else if (value->isBool()) {
+    if (value->getBool()) {
+      put(out, "true", 4);
+    } else {
+      put(out, "false", 5);
+    }
+  } else {
+    put(out, "null", 4);
+  }
+}
+
+}
+
+void write_json(FrameBuffer& out, JValue* value) {
+  write_value(out, value);
+}
+
+void write_json(std::string& out, JValue* value) {
+  write_value(out, value);
+}
+
+void write_json_string(std::string& out, const char* str, size_t len) {
+  write_string(out, str, len);
+}
+
+void write_json_real(std::string& out, double value) {
+  if (!std::isfinite(value)) {
+    out.append("null");
+    return;
+  }
+  append_real(out, value);
+}
+
+static bool send_all(int sock, struct iovec* iov, int count) {
+  while (count > 0) {
+    ssize_t len = ::writev(sock, iov, count);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      return false;
+    }
+
+    // skip what went out, a short write leaves off inside some iovec
+    while (count > 0 && (size_t)len >= iov->iov_len) {
+      len -= iov->iov_len;
+      iov ++;
+      count --;
+    }
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + len;
+      iov->iov_len -= len;
+    }
+  }
+  return true;
+}
+
+bool send_frame(int sock, const FrameBuffer& frame) {
+  struct iovec iov[1];
+  iov[0].iov_base = (void*)frame.data();
+  iov[0].iov_len = frame.size();
+  return send_all(sock, iov, 1);
+}
+
+bool send_frame(int sock, const char* msg, size_t len) {
+  int size = len;
+  struct iovec iov[2];
+  iov[0].iov_base = &size;
+  iov[0].iov_len = sizeof(int);
+  iov[1].iov_base = (void*)msg;
+  iov[1].iov_len = len;
+  return send_all(sock, iov, 2);
+}
+
+bool send_frames(int sock, const std::vector<std::string>& msgs) {
+  // prefix and message of every frame, IOV_MAX bounds a single writev
+  static const size_t MAX_IOV = 1024;
+  std::vector<int> sizes(msgs.size());
+  std::vector<struct iovec> iov(2 * msgs.size());
+  for(size_t i = 0; i < msgs.size(); i ++) {
+    sizes[i] = msgs[i].size();
+    iov[2 * i].iov_base = &sizes[i];
+    iov[2 * i].iov_len = sizeof(int);
+    iov[2 * i + 1].iov_base = (void*)msgs[i].data();
+    iov[2 * i + 1].iov_len = msgs[i].size();
+  }
+
+  for(size_t i = 0; i < iov.size(); i += MAX_IOV) {
+    if (!send_all(sock, &iov[i], std::min(MAX_IOV, iov.size() - i))) {
+      return false;
+    }
+  }
+  return true;
+}
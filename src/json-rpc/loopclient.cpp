@@ -0,0 +1,74 @@
+#include "json-rpc/client/loopclient.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+void LoopbackClient::send_and_response(std::string value, std::string& result) {
+  _run([&]() {
+    result = _server.serve(value);
+  });
+}
+
+void LoopbackClient::send_and_stream(std::string value, std::function<bool(std::string&)> on_frame) {
+  std::string result;
+  _run([&]() {
+    result = _server.serve(value, [&](const std::string& frame) {
+      std::string chunk = frame;
+      on_frame(chunk);
+    });
+  });
+  on_frame(result);
+}
+
+void LoopbackClient::stream_and_response(std::string value, std::function<bool(std::string&)> next_frame,
+                                         std::string& result) {
+  _run([&]() {
+    result = _server.serve(value, nullptr, next_frame);
+  });
+}
+
+bool LoopbackClient::call_direct(int clientno, int messageid, long timestamp,
+                                 size_t method_hash, OutSerializer& sout,
+                                 const std::string& attachments, JValue*& resp,
+                                 std::string& resp_attachments) {
+  if (!_direct) return false;
+
+  JValue* params = sout.getContent();
+  _run([&]() {
+    resp = _server.serve(clientno, messageid, timestamp, method_hash, params,
+                         attachments, resp_attachments);
+  });
+  return true;
+}
+
+/* Run job on the executor if there is one and wait for it
+ */
+void LoopbackClient::_run(std::function<void()> job) {
+  if (!_executor) {
+    job();
+    return;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool done = false;
+  std::exception_ptr error;
+
+  _executor([&]() {
+    try {
+      job();
+    } catch(...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> _(mutex);
+    done = true;
+    cond.notify_one();
+  });
+
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [&]() { return done; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,379 @@
+#include "json-rpc/util.hpp"
+#include "json-rpc/frame.hpp"
+#include "json-rpc/proto.hpp"
+#include "json-rpc/errors.hpp"
+
+#include "json-rpc/client/muxclient.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+
+/* Requests and responses are told apart by clientno and messageid */
+static bool message_key(const char* text, size_t len, uint64_t& key) {
+  int clientno = 0;
+  int messageid = 0;
+  if (!Proto::message_ids(text, len, clientno, messageid)) {
+    return false;
+  }
+  key = ((uint64_t)(uint32_t)clientno << 32) | (uint32_t)messageid;
+  return true;
+}
+
+MuxClient::MuxClient(std::string host, std::string port, long flush_us, size_t flush_bytes)
+    : _host(host), _port(port), _server_info(nullptr), _family(AF_UNSPEC),
+      _flush_window(flush_us), _flush_bytes(flush_bytes), _sock(UNINIT_SOCKET),
+      _generation(0), _closing(false), _queued_bytes(0), _flushing(false), _frames_sent(0),
+      _flushes(0) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  int r = getaddrinfo(host.c_str(), port.c_str(), &hints, &_server_info);
+  if (r != 0) {
+    LOG(DEBUG) << "getaddrinfo error!" << std::endl;
+    throw HostFailException("Function getaddrinfo fail", _host, _port);
+  }
+}
+
+MuxClient::MuxClient(UnixPath path, long flush_us, size_t flush_bytes)
+    : _host("unix"), _port(path.path), _server_info(nullptr), _unix_path(path.path),
+      _family(AF_UNIX), _flush_window(flush_us), _flush_bytes(flush_bytes),
+      _sock(UNINIT_SOCKET), _generation(0), _closing(false), _queued_bytes(0),
+      _flushing(false), _frames_sent(0), _flushes(0) {
+  struct sockaddr_un addr;
+  if (!unix_addr(_unix_path, addr)) {
+    throw HostFailException("Unix socket path too long", _host, _port);
+  }
+}
+
+MuxClient::~MuxClient() {
+  {
+    std::lock_guard<std::mutex> _(_mutex);
+    _closing = true;
+    _drop(_generation, READ_FAIL);
+  }
+  for(auto it = _readers.begin(); it != _readers.end(); it ++) {
+    it->second.join();
+  }
+  // runs the callbacks still queued
+  _pool.reset();
+  if (_server_info) {
+    freeaddrinfo(_server_info);
+  }
+}
+
+void MuxClient::send_and_response(std::string message, std::string& result) {
+  uint64_t key = 0;
+  if (!message_key(message.data(), message.size(), key)) {
+    throw std::runtime_error("MuxClient needs clientno and messageid leading the request");
+  }
+
+  Call call(&result);
+  std::unique_lock<std::mutex> lock(_mutex);
+  _enqueue(key, message, &call);
+
+  if (_flushing) {
+    // the caller that queued first writes this one too
+    if (_queued_bytes >= _flush_bytes) {
+      _flush_cond.notify_one();
+    }
+  } else {
+    _flushing = true;
+    _flush_cond.wait_for(lock, _flush_window, [this] { return _queued_bytes >= _flush_bytes; });
+    _flush(lock);
+  }
+
+  call.cond.wait(lock, [&call] { return call.done; });
+  if (call.error == READ_FAIL) {
+    throw ReadFailException();
+  }
+  if (call.error == WRITE_FAIL) {
+    throw WriteFailException();
+  }
+}
+
+void MuxClient::send_async(std::string message,
+                           std::function<void(std::string&, std::exception_ptr)> done) {
+  std::string none;
+  uint64_t key = 0;
+  if (!message_key(message.data(), message.size(), key)) {
+    done(none, std::make_exception_ptr(
+        std::runtime_error("MuxClient needs clientno and messageid leading the request")));
+    return;
+  }
+
+  Call* call = new Call(nullptr);
+  call->on_done = done;
+  std::unique_lock<std::mutex> lock(_mutex);
+  try {
+    _enqueue(key, message, call);
+  } catch(...) {
+    lock.unlock();
+    delete call;
+    done(none, std::current_exception());
+    return;
+  }
+
+  // the caller doesn't wait, so it doesn't gather a batch either
+  if (!_flushing) {
+    _flush(lock);
+  } else if (_queued_bytes >= _flush_bytes) {
+    _flush_cond.notify_one();
+  }
+}
+
+void MuxClient::reconnect() {
+  std::lock_guard<std::mutex> _(_mutex);
+  _drop(_generation, READ_FAIL);
+  _connect();
+}
+
+uint64_t MuxClient::frames_sent() {
+  std::lock_guard<std::mutex> _(_mutex);
+  return _frames_sent;
+}
+
+uint64_t MuxClient::flushes() {
+  std::lock_guard<std::mutex> _(_mutex);
+  return _flushes;
+}
+
+/* Register call and queue message, connecting first if there is no
+ * connection. _mutex is held.
+ */
+void MuxClient::_enqueue(uint64_t key, std::string& message, Call* call) {
+  if (_closing) {
+    throw std::runtime_error("MuxClient is closing");
+  }
+  if (_sock == UNINIT_SOCKET) {
+    _connect();
+  }
+  if (_calls.count(key) != 0) {
+    throw std::runtime_error("MuxClient has a request with the same messageid in flight");
+  }
+  _calls[key] = call;
+  _queued_bytes += message.size() + sizeof(int);
+  _queue.push_back(std::move(message));
+}
+
+/* Write what is queued, _mutex is held on entry and on return */
+void MuxClient::_flush(std::unique_lock<std::mutex>& lock) {
+  std::vector<std::string> frames;
+  frames.swap(_queue);
+  _queued_bytes = 0;
+  _flushing = false;
+  uint64_t generation = _generation;
+  int sock = _sock;
+  lock.unlock();
+
+  bool sent = false;
+  {
+    // the socket is still open as long as the generation didn't move on
+    std::lock_guard<std::mutex> _(_write_mutex);
+    if (sock != UNINIT_SOCKET && _generation == generation) {
+      sent = send_frames(sock, frames);
+    }
+  }
+
+  lock.lock();
+  _flushes ++;
+  _frames_sent += frames.size();
+  if (!sent) {
+    LOG(INFO) << "write function error" << std::endl;
+    _drop(generation, WRITE_FAIL);
+  }
+}
+
+/* Give up on the connection of generation and fail every call waiting on
+ * it, its reader closes the socket and fails the send_async calls. _mutex
+ * is held.
+ */
+void MuxClient::_drop(uint64_t generation, int error) {
+  if (generation != _generation || _sock == UNINIT_SOCKET) {
+    return;
+  }
+  _generation ++;
+  ::shutdown(_sock, SHUT_RDWR);
+  _sock = UNINIT_SOCKET;
+
+  for(auto it = _calls.begin(); it != _calls.end(); it ++) {
+    it->second->error = error;
+    it->second->done = true;
+    if (it->second->on_done) {
+      _failed.push_back(it->second);
+    } else {
+      it->second->cond.notify_one();
+    }
+  }
+  _calls.clear();
+}
+
+/* Join the readers of dropped connections that are done, they don't
+ * take _mutex any more. _mutex is held.
+ */
+void MuxClient::_reap() {
+  for(size_t i = 0; i < _exited.size(); i ++) {
+    auto it = _readers.find(_exited[i]);
+    if (it != _readers.end()) {
+      it->second.join();
+      _readers.erase(it);
+    }
+  }
+  _exited.clear();
+}
+
+/* Connect and start a reader for the new connection, _mutex is held */
+void MuxClient::_connect() {
+  _reap();
+  int sock = UNINIT_SOCKET;
+  if (!_unix_path.empty()) {
+    struct sockaddr_un addr;
+    unix_addr(_unix_path, addr);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == UNINIT_SOCKET) {
+      throw SocketFailException("socket");
+    }
+    _options.apply_connection(sock, AF_UNIX, true);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_un)) != 0) {
+      close(sock);
+      sock = UNINIT_SOCKET;
+    }
+  } else {
+    for(struct addrinfo* ptr = _server_info; ptr != nullptr; ptr = ptr->ai_next) {
+      sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+      if (sock == UNINIT_SOCKET) {
+        continue;
+      }
+      _family = ptr->ai_family;
+      _options.apply_connection(sock, _family, true);
+      if (connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen) == 0) {
+        break;
+      }
+      close(sock);
+      sock = UNINIT_SOCKET;
+    }
+  }
+
+  if (sock == UNINIT_SOCKET) {
+    LOG(DEBUG) << "Can't connect to server" << std::endl;
+    throw HostFailException("Can't connect", _host, _port);
+  }
+  LOG(DEBUG) << "connect to server" << std::endl;
+
+  _sock = sock;
+  _readers[_generation] = std::thread(&MuxClient::_read_loop, this, sock, (uint64_t)_generation);
+}
+
+void MuxClient::_read_loop(int sock, uint64_t generation) {
+  static const size_t CHUNK_SIZE = 64 * 1024;
+  std::vector<char> chunk(CHUNK_SIZE);
+  std::string buffer;
+  bool broken = false;
+
+  while (!broken) {
+    ssize_t len = read(sock, chunk.data(), CHUNK_SIZE);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      break;
+    }
+    _options.rearm(sock, _family);
+    buffer.append(chunk.data(), len);
+
+    // hand out every complete frame, one read may carry several
+    size_t pos = 0;
+    while (buffer.size() - pos >= sizeof(int)) {
+      int size = 0;
+      memcpy(&size, buffer.data() + pos, sizeof(int));
+      if (size <= 0) {
+        broken = true;
+        break;
+      }
+      if (buffer.size() - pos - sizeof(int) < (size_t)size) {
+        break;
+      }
+      std::string frame(buffer, pos + sizeof(int), size);
+      pos += sizeof(int) + size;
+      if (!_deliver(frame)) {
+        broken = true;
+        break;
+      }
+    }
+    buffer.erase(0, pos);
+  }
+
+  std::vector<Call*> failed;
+  {
+    std::lock_guard<std::mutex> _(_mutex);
+    _drop(generation, READ_FAIL);
+    failed.swap(_failed);
+  }
+  {
+    std::lock_guard<std::mutex> _(_write_mutex);
+    close(sock);
+  }
+
+  std::string none;
+  for(size_t i = 0; i < failed.size(); i ++) {
+    if (failed[i]->error == WRITE_FAIL) {
+      _done(failed[i], none, std::make_exception_ptr(WriteFailException()));
+    } else {
+      _done(failed[i], none, std::make_exception_ptr(ReadFailException()));
+    }
+  }
+
+  // the next connect joins this thread
+  std::lock_guard<std::mutex> _(_mutex);
+  _exited.push_back(generation);
+}
+
+/* Hand the response of a send_async call to its callback, off the reader
+ * thread. Deletes call.
+ */
+void MuxClient::_done(Call* call, std::string& result, std::exception_ptr error) {
+  std::shared_ptr<std::string> text(new std::string());
+  text->swap(result);
+  std::function<void()> job = [call, text, error]() {
+    call->on_done(*text, error);
+    delete call;
+  };
+
+  if (_executor) {
+    _executor(job);
+    return;
+  }
+  std::call_once(_pool_once, [this]() { _pool.reset(new ThreadPool()); });
+  _pool->add(job);
+}
+
+/* Wake the caller frame answers. False if the frame doesn't say which
+ * request it answers, the connection can't be trusted after that.
+ */
+bool MuxClient::_deliver(std::string& frame) {
+  uint64_t key = 0;
+  if (!message_key(frame.data(), frame.size(), key)) {
+    LOG(INFO) << "Response without messageid on a multiplexed connection" << std::endl;
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto it = _calls.find(key);
+  if (it == _calls.end()) {
+    // its caller gave up on an older connection already
+    LOG(DEBUG) << "Drop response of a call not waiting anymore" << std::endl;
+    return true;
+  }
+  Call* call = it->second;
+  _calls.erase(it);
+  if (call->on_done) {
+    lock.unlock();
+    _done(call, frame, nullptr);
+    return true;
+  }
+  call->result->swap(frame);
+  call->done = true;
+  call->cond.notify_one();
+  return true;
+}
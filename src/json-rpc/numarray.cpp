@@ -0,0 +1,372 @@
+#include "json-rpc/numarray.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define JSONRPC_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace numeric {
+
+/* Character classes, 1 for what an integer array can hold, 2 for what only
+ * a real array can
+ */
+static unsigned char g_class[256];
+
+static bool init_class() {
+  for(int c = '0'; c <= '9'; c ++) g_class[c] = 1;
+  g_class[(int)','] = g_class[(int)'-'] = g_class[(int)'+'] = 1;
+  g_class[(int)' '] = g_class[(int)'\t'] = g_class[(int)'\n'] = g_class[(int)'\r'] = 1;
+  g_class[(int)'.'] = g_class[(int)'e'] = g_class[(int)'E'] = 2;
+  return true;
+}
+
+static bool g_class_ready = init_class();
+
+static bool validate_scalar(const char* text, size_t len, bool real, size_t& separators) {
+  unsigned char allowed = real ? 2 : 1;
+  size_t commas = 0;
+  for(size_t i = 0; i < len; i ++) {
+    unsigned char cls = g_class[(unsigned char)text[i]];
+    if (cls == 0 || cls > allowed) return false;
+    commas += text[i] == ',';
+  }
+  separators += commas;
+  return true;
+}
+
+#ifdef JSONRPC_X86_KERNELS
+
+/* SSE4.2 checks 16 bytes per step against character ranges. ',' sits
+ * between '+' and '-', and "\t\r" lets \v and \f through, the parser turns
+ * those down anyway.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static bool validate_sse42(const char* text, size_t len, bool real, size_t& separators) {
+  static const char int_ranges[16] = "09+-  \t\r";
+  static const char real_ranges[16] = "09+.  \t\reeEE";
+  const __m128i ranges = _mm_loadu_si128((const __m128i*)(real ? real_ranges : int_ranges));
+  const int nranges = real ? 12 : 8;
+  const __m128i comma = _mm_set1_epi8(',');
+
+  size_t commas = 0;
+  size_t i = 0;
+  for(; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+    int bad = _mm_cmpestri(ranges, nranges, block, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY);
+    if (bad != 16) return false;
+    commas += _mm_popcnt_u32(_mm_movemask_epi8(_mm_cmpeq_epi8(block, comma)));
+  }
+
+  separators += commas;
+  return validate_scalar(text + i, len - i, real, separators);
+}
+
+/* AVX2 checks 32 bytes per step, a byte is fine if it is a digit or equals
+ * one of the few other characters allowed
+ */
+__attribute__((target("avx2,popcnt")))
+static bool validate_avx2(const char* text, size_t len, bool real, size_t& separators) {
+  const __m256i zero = _mm256_set1_epi8('0');
+  const __m256i nine = _mm256_set1_epi8(9);
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i minus = _mm256_set1_epi8('-');
+  const __m256i plus = _mm256_set1_epi8('+');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i e = _mm256_set1_epi8('e');
+  const __m256i big_e = _mm256_set1_epi8('E');
+
+  size_t commas = 0;
+  size_t i = 0;
+  for(; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)(text + i));
+    __m256i d = _mm256_sub_epi8(block, zero);
+    __m256i ok = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+    __m256i is_comma = _mm256_cmpeq_epi8(block, comma);
+    ok = _mm256_or_si256(ok, is_comma);
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, minus));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, plus));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, space));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, tab));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, lf));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, cr));
+    if (real) {
+      ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, dot));
+      ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, e));
+      ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(block, big_e));
+    }
+    if ((uint32_t)_mm256_movemask_epi8(ok) != 0xFFFFFFFFu) return false;
+    commas += _mm_popcnt_u32(_mm256_movemask_epi8(is_comma));
+  }
+
+  separators += commas;
+  return validate_scalar(text + i, len - i, real, separators);
+}
+
+#endif
+
+typedef bool (*ValidateFn)(const char*, size_t, bool, size_t&);
+
+struct Kernel {
+  ValidateFn fn;
+  const char* name;
+};
+
+static Kernel pick_kernel() {
+#ifdef JSONRPC_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return Kernel{validate_avx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+    return Kernel{validate_sse42, "sse4.2"};
+  }
+#endif
+  return Kernel{validate_scalar, "scalar"};
+}
+
+static const Kernel& kernel_in_use() {
+  static const Kernel kernel = pick_kernel();
+  return kernel;
+}
+
+bool validate(const char* text, size_t len, bool real, size_t& separators) {
+  return kernel_in_use().fn(text, len, real, separators);
+}
+
+const char* kernel() {
+  return kernel_in_use().name;
+}
+
+static const char g_digit_pairs[201] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+void append(std::string& out, long long value) {
+  char buf[24];
+  char* end = buf + sizeof(buf);
+  char* p = end;
+
+  unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : value;
+  while (v >= 100) {
+    unsigned idx = (v % 100) * 2;
+    v /= 100;
+    *--p = g_digit_pairs[idx + 1];
+    *--p = g_digit_pairs[idx];
+  }
+  if (v >= 10) {
+    *--p = g_digit_pairs[v * 2 + 1];
+    *--p = g_digit_pairs[v * 2];
+  } else {
+    *--p = '0' + v;
+  }
+  if (value < 0) *--p = '-';
+
+  out.append(p, end - p);
+}
+
+static const double g_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+void append(std::string& out, double value) {
+  // json has no nan or inf, written as null like write_json_real does
+  if (!std::isfinite(value)) {
+    out.append("null");
+    return;
+  }
+  if (value == 0 && std::signbit(value)) {
+    out.append("-0");
+    return;
+  }
+
+  // values with a few decimals skip the printf, when scaling them by a power
+  // of ten gives an exact whole number that parse divides back to value
+  if (std::fabs(value) < 1e15) {
+    for(int k = 0; k <= 8; k ++) {
+      double scaled = value * g_pow10[k];
+      if (std::fabs(scaled) >= 9e15) break;
+      if (scaled != (double)(long long)scaled || scaled / g_pow10[k] != value) continue;
+
+      long long whole = (long long)scaled;
+      if (k == 0) {
+        append(out, whole);
+        return;
+      }
+
+      std::string digits;
+      append(digits, whole < 0 ? -whole : whole);
+      if (digits.size() <= (size_t)k) {
+        digits.insert(0, k + 1 - digits.size(), '0');
+      }
+      if (whole < 0) out.push_back('-');
+      out.append(digits, 0, digits.size() - k);
+      out.push_back('.');
+      out.append(digits, digits.size() - k, k);
+      return;
+    }
+  }
+
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.17g", value);
+  out.append(buf, len);
+}
+
+static inline bool is_digit(char c) {
+  return (unsigned char)(c - '0') < 10;
+}
+
+/* True if the eight bytes at p are all digits */
+static inline bool eight_digits(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+           (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+          0x3333333333333333ULL);
+}
+
+/* Value of the eight digits at p, converted in one go with three
+ * multiplications
+ */
+static inline uint32_t parse_eight(const char* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v;
+  memcpy(&v, p, 8);
+  v -= 0x3030303030303030ULL;
+  v = (v * 10) + (v >> 8);
+  v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+       (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return (uint32_t)v;
+#else
+  uint32_t v = 0;
+  for(int i = 0; i < 8; i ++) v = v * 10 + (p[i] - '0');
+  return v;
+#endif
+}
+
+/* Digits at p as an unsigned number, count gets how many there were. Only
+ * the first 19 digits count, more don't fit anyway.
+ */
+static inline unsigned long long parse_digits(const char*& p, const char* end, int& count) {
+  const char* start = p;
+  unsigned long long v = 0;
+  while (end - p >= 8 && p - start <= 11 && eight_digits(p)) {
+    v = v * 100000000ULL + parse_eight(p);
+    p += 8;
+  }
+  while (p < end && is_digit(*p)) {
+    if (p - start < 19) v = v * 10 + (*p - '0');
+    p ++;
+  }
+  count = p - start;
+  return v;
+}
+
+bool parse(const char*& p, const char* end, long long& value) {
+  skip_space(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p ++;
+  }
+
+  int count = 0;
+  unsigned long long v = parse_digits(p, end, count);
+  if (count == 0 || count > 19) {
+    return false;
+  }
+
+  if (negative) {
+    if (v > 9223372036854775808ULL) return false;
+    value = (long long)(0ULL - v);
+  } else {
+    if (v > 9223372036854775807ULL) return false;
+    value = (long long)v;
+  }
+  return true;
+}
+
+bool parse(const char*& p, const char* end, double& value) {
+  skip_space(p, end);
+  if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+    // what append writes for NaN and infinities
+    value = std::numeric_limits<double>::quiet_NaN();
+    p += 4;
+    return true;
+  }
+  const char* start = p;
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p ++;
+  }
+
+  int int_digits = 0;
+  unsigned long long mantissa = parse_digits(p, end, int_digits);
+  int frac_digits = 0;
+  if (p < end && *p == '.') {
+    p ++;
+    const char* frac = p;
+    while (p < end && is_digit(*p)) {
+      if (int_digits + (p - frac) < 19) mantissa = mantissa * 10 + (*p - '0');
+      p ++;
+    }
+    frac_digits = p - frac;
+  }
+  if (int_digits + frac_digits == 0) {
+    return false;
+  }
+
+  long exponent = 0;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p ++;
+    bool exp_negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      exp_negative = *p == '-';
+      p ++;
+    }
+    if (p == end || !is_digit(*p)) return false;
+    while (p < end && is_digit(*p)) {
+      if (exponent < 100000) exponent = exponent * 10 + (*p - '0');
+      p ++;
+    }
+    if (exp_negative) exponent = -exponent;
+  }
+
+  // exact when the mantissa and the power of ten are both exact doubles
+  long scale = exponent - frac_digits;
+  if (int_digits + frac_digits <= 15 && scale >= -22 && scale <= 22) {
+    double d = (double)mantissa;
+    d = scale < 0 ? d / g_pow10[-scale] : d * g_pow10[scale];
+    value = negative ? -d : d;
+    return true;
+  }
+
+  // rare long or far out values, leave them to strtod
+  std::string text(start, p - start);
+  char* stop = nullptr;
+  value = strtod(text.c_str(), &stop);
+  return stop == text.c_str() + text.size();
+}
+
+}
@@ -1,8 +1,24 @@
 #include "json-rpc/server/pollserver.hpp"
 #include "json-rpc/util.hpp"
+#include "json-rpc/proto.hpp"
 #include <vector>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 
 static const int MAX_BUFF_SIZE = 1024;
+static const size_t MAX_UPLOAD_FRAMES = 16;
+static const int MAX_WRITE_FRAMES = 64; // frames gathered by one writev
+static const int MAX_ACCEPTS = 64;      // connections taken per loop pass
+static const uint64_t OVERFLOW_LOG_MS = 1000;
+
+static uint64_t clock_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 PollManager::PollManager(): _highest(0) {
   _watched_read_fds.clear();
@@ -32,6 +48,24 @@ void PollManager::watch(int fd, FD_MODE mod) {
   }
 }
 
+void PollManager::watch_all(const std::vector<int>& fds, FD_MODE mod) {
+  if (fds.empty()) {
+    return;
+  }
+  ScopeLock _(&_mutex);
+  fd_set& set = mod == FD_MODE::READ ? _read_set : _write_set;
+  std::unordered_set<int>& watched = mod == FD_MODE::READ ? _watched_read_fds : _watched_write_fds;
+  for(size_t i = 0; i < fds.size(); i ++) {
+    FD_SET(fds[i], &set);
+    watched.insert(fds[i]);
+    if (fds[i] > _highest) {
+      _highest = fds[i];
+    }
+  }
+
+  LOG(DEBUG) << VarString::format("watch %d fds as %d", (int)fds.size(), mod) << std::endl;
+}
+
 void PollManager::unwatch(int fd, FD_MODE mod) {
   ScopeLock _(&_mutex);
   if (mod == FD_MODE::READ) {
@@ -64,7 +98,8 @@ void PollManager::unwatch(int fd, FD_MODE mod) {
   _highest = new_highest;
 }
 
-bool PollManager::poll(std::vector<int>& reads, std::vector<int>& writes) {
+bool PollManager::poll(std::vector<int>& reads, std::vector<int>& writes, long timeout_ms) {
+  uint64_t start = timeout_ms > 0 ? clock_ms() : 0;
   while (true) {
     fd_set read_set;
     fd_set write_set;
@@ -96,16 +131,26 @@ bool PollManager::poll(std::vector<int>& reads, std::vector<int>& writes) {
     if (reads.size() != 0 || writes.size() != 0) {
       break;
     }
+    if (timeout_ms == 0 || (timeout_ms > 0 && clock_ms() - start >= (uint64_t)timeout_ms)) {
+      break;
+    }
   }
   return true;
 }
 
-Channel::Channel(int sock, PollServer* server)
-    :_sock(sock),
-     _read_buffer(nullptr), _write_buffer(nullptr),
-     _send_mutex(), _read_mutex(), _read_cond(&_read_mutex),
-     _alive(true), _busy(false) {
-  nonblock_fd(_sock);
+Channel::Channel(int sock, uint64_t id, PollServer* server)
+    :_sock(sock), _id(id), _server(server),
+     _trace_id(0), _queued_at(0),
+     _out_pos(0), _written(0), _write_watched(false), _open(true), _request(0), _write_buffer(nullptr),
+     _alive(true), _held(false),
+     _uploading(false), _upload_owner(false), _upload_paused(false),
+     _orphaned(false) {
+  // accept4 made the socket nonblocking already
+  _timers.last_active = 0;
+  _timers.last_write = 0;
+  _timers.idle = 0;
+  _timers.stall = 0;
+  _timers.in_flight = 0;
 }
 
 Channel::~Channel() {
@@ -113,15 +158,18 @@ Channel::~Channel() {
     close();
   }
 
-  if (_read_buffer) delete _read_buffer;
+  for(size_t i = 0; i < _out.size(); i ++) {
+    FramePool::get_instance().release(_out[i].frame);
+  }
   if (_write_buffer) delete _write_buffer;
 }
 
 Channel::State Channel::read() {
-  while (_busy) {
-    LOG(DEBUG) << "Busy, waiting for operatio to finish" << std::endl;
-    _read_cond.wait();
+  if (_write_buffer == nullptr) {
+    // a new message starts, decide whether to trace it
+    _trace_id = Tracer::get_instance().start_trace();
   }
+  TraceScope span("Channel::read", _trace_id);
 
   if (_write_buffer == nullptr) {
     int size = 0;
@@ -133,7 +181,6 @@ Channel::State Channel::read() {
 
     if (len != sizeof(int) || size <= 0) {
       LOG(INFO) << "Error when read size of incoming message" << std::endl;
-      _busy = true;
       return State::BROKEN;
     }
 
@@ -141,72 +188,134 @@ Channel::State Channel::read() {
     _write_buffer = new SizedWRONBuffer(size);
   }
 
+  // never read past this message, the next frame may follow right away
   char chunk[MAX_BUFF_SIZE];
   int len;
-  len = ::read(_sock, chunk, MAX_BUFF_SIZE);
+  len = ::read(_sock, chunk, std::min((size_t)MAX_BUFF_SIZE, _write_buffer->remaining()));
+  _server->socket_options().rearm(_sock, _server->family());
+
+  if (len == 0) {
+    return State::CLOSED;
+  }
+  if (len < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? State::READ_PENDING : State::CLOSED;
+  }
 
   _write_buffer->write(chunk, len);
 
   if (!_write_buffer->ready()) {
     return Channel::State::READ_PENDING;
   } else {
-    _busy = true;
-    LOG(DEBUG) << "Set to busy" << std::endl;
     return Channel::State::READ_READY;
   }
 }
 
 Channel::State Channel::write() {
-  char chunk[MAX_BUFF_SIZE];
-  int len;
-
-  if (_read_buffer == nullptr) return State::WRITE_PENDING;
-  len = _read_buffer->read(chunk, MAX_BUFF_SIZE);
-  chunk[len] = '\0';
+  State state = State::WRITE_READY;
+  while (!_out.empty()) {
+    struct iovec iov[MAX_WRITE_FRAMES];
+    int count = 0;
+    size_t pos = _out_pos;
+    for(auto it = _out.begin(); it != _out.end() && count < MAX_WRITE_FRAMES; it ++) {
+      iov[count].iov_base = (void*)(it->frame->data() + pos);
+      iov[count].iov_len = it->frame->size() - pos;
+      count ++;
+      pos = 0;
+    }
 
-  ::write(_sock, chunk, len);
+    ssize_t len = ::writev(_sock, iov, count);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      state = State::WRITE_PENDING;
+      break;
+    }
+    if (len < 0) {
+      LOG(INFO) << "Error when write to socket " << _sock << std::endl;
+      state = State::CLOSED;
+      break;
+    }
 
-  if (_read_buffer->ready()) {
-    _send_mutex.unlock();
-    return State::WRITE_READY;
+    // give back the frames written completely
+    _written += len;
+    size_t written = len;
+    while (written > 0) {
+      OutFrame& out = _out.front();
+      size_t rest = out.frame->size() - _out_pos;
+      if (written < rest) {
+        _out_pos += written;
+        break;
+      }
+      written -= rest;
+      _out_pos = 0;
+      if (out.trace_id) {
+        Tracer::get_instance().record("Channel::write", out.start, Tracer::now(), out.trace_id);
+      }
+      FramePool::get_instance().release(out.frame);
+      _out.pop_front();
+    }
   }
 
-  return State::WRITE_PENDING;
-}
-
-void Channel::send(std::string msg) {
-  send(msg.c_str(), msg.size());
-}
-
-void Channel::send(const char* msg, size_t len) {
-  _send_mutex.lock();
-  LOG(DEBUG) << "get send lock" << std::endl;
-  if (_alive == false) {
-    _send_mutex.unlock();
-    return;
+  if (state == State::CLOSED) {
+    // the reader finds the connection gone as well
+    for(size_t i = 0; i < _out.size(); i ++) {
+      FramePool::get_instance().release(_out[i].frame);
+    }
+    _out.clear();
+    _out_pos = 0;
   }
 
-  if (_read_buffer != nullptr) {
-    delete _read_buffer;
+  bool watch = state == State::WRITE_PENDING;
+  if (watch != _write_watched) {
+    if (watch) {
+      PollManager::get_instance().watch(_sock, FD_MODE::WRITE);
+    } else {
+      PollManager::get_instance().unwatch(_sock, FD_MODE::WRITE);
+    }
+    _write_watched = watch;
   }
+  return state;
+}
 
-  _read_buffer = new SizedRDONBuffer(msg, len);
-  State state = write();
-  if (state != State::WRITE_READY) {
-    PollManager::get_instance().watch(_sock, FD_MODE::WRITE);
-  } else {
-    _send_mutex.unlock();
+bool Channel::queue(FrameBuffer* frame, uint64_t trace_id) {
+  if (!_open) {
+    FramePool::get_instance().release(frame);
+    return false;
   }
+
+  OutFrame out;
+  out.frame = frame;
+  out.trace_id = trace_id;
+  out.start = trace_id ? Tracer::now() : 0;
+  _out.push_back(out);
+  return _out.size() == 1;
 }
 
 void Channel::close() {
-  ScopeLock _(&_send_mutex);
+  _open = false;
   shutdown(_sock, SHUT_RDWR);
   ::close(_sock);
+
+  // wake a handler waiting for upload frames
+  std::lock_guard<std::mutex> _(_upload_mutex);
   _alive = false;
+  _upload_cond.notify_all();
+}
+
+void Channel::message_ids(int& clientno, int& messageid) {
+  if (_write_buffer == nullptr ||
+      !Proto::message_ids(_write_buffer->c_str(), _write_buffer->size(), clientno, messageid)) {
+    // its deadline error can't be matched to the request then
+    LOG(INFO) << "Can't tell clientno and messageid of the message on connection "
+              << _sock << std::endl;
+    clientno = -1;
+    messageid = -1;
+  }
 }
 
 bool Channel::is_alive() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
   return _alive;
 }
 
@@ -214,46 +323,165 @@ std::string Channel::get_msg() {
   if (_write_buffer == nullptr) {
     return "";
   }
-  std::string msg = "";
-  msg.assign(_write_buffer->c_str());
+  std::string msg(_write_buffer->c_str(), _write_buffer->size());
   return msg;
 }
 
-void Channel::clear_msg() {
+void Channel::hold() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  _held = true;
+  PollManager::get_instance().unwatch(_sock, FD_MODE::READ);
+}
+
+bool Channel::clear_msg() {
   if (_write_buffer != nullptr) {
     delete _write_buffer;
   }
   _write_buffer = nullptr;
-  _busy = false;
-  _read_cond.notify_all();
+
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  if (!_held) {
+    // the reactor took an upload frame, it reads on anyway
+    return false;
+  }
+  _held = false;
+  if (_orphaned) {
+    return !_upload_owner;
+  }
+  _server->_post_resume(_sock, _id);
+  return false;
+}
+
+void Channel::start_upload() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  _uploading = true;
+  _upload_owner = true;
+}
+
+bool Channel::uploading() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  return _uploading;
+}
+
+void Channel::push_frame() {
+  std::string frame = get_msg();
+  clear_msg();
+
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  if (Proto::is_end(frame)) {
+    // whatever comes next is a request again
+    _uploading = false;
+  }
+  _upload_frames.push_back(std::move(frame));
+  if (_uploading && _upload_frames.size() >= MAX_UPLOAD_FRAMES) {
+    PollManager::get_instance().unwatch(_sock, FD_MODE::READ);
+    _upload_paused = true;
+  }
+  _upload_cond.notify_all();
+}
+
+bool Channel::next_frame(std::string& frame) {
+  std::unique_lock<std::mutex> lock(_upload_mutex);
+  while (_upload_frames.empty() && _alive) {
+    _upload_cond.wait(lock);
+  }
+  if (_upload_frames.empty()) {
+    return false;
+  }
+
+  frame = std::move(_upload_frames.front());
+  _upload_frames.pop_front();
+  if (_upload_paused && _alive && _upload_frames.size() < MAX_UPLOAD_FRAMES / 2) {
+    // the reactor watches the socket again
+    _upload_paused = false;
+    _server->_post_resume(_sock, _id);
+  }
+  return true;
+}
+
+bool Channel::finish_upload() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  _upload_owner = false;
+  _uploading = false;
+  _upload_frames.clear();
+  if (_upload_paused && _alive) {
+    _server->_post_resume(_sock, _id);
+  }
+  _upload_paused = false;
+  return _orphaned;
+}
+
+bool Channel::release() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  if (_upload_owner || _held) {
+    _orphaned = true;
+    return false;
+  }
+  return true;
+}
+
+void Channel::resume_read() {
+  std::lock_guard<std::mutex> _(_upload_mutex);
+  if (_alive && !_held && !_upload_paused) {
+    PollManager::get_instance().watch(_sock, FD_MODE::READ);
+  }
 }
 
 PollServer::PollServer(std::string port)
-    :ServerConnector(port), _stop(false), _thread(this) {
+    :ServerConnector(port), _thread_pool(new ThreadPool()), _queued(0), _stop(false), _next_channel_id(0), _wake_fd(-1),
+     _wake_pending(false), _idle_timeout(0), _write_timeout(0), _request_timeout(0),
+     _wheel(clock_ms()), _now(clock_ms()), _next_request(0), _spare_fd(-1), _accepted(0),
+     _rejected(0), _backlog_overflows(0), _overflow_logged_at(0), _thread(this) {
+}
+
+PollServer::PollServer(UnixPath path)
+    :ServerConnector(path), _thread_pool(new ThreadPool()), _queued(0), _stop(false), _next_channel_id(0), _wake_fd(-1),
+     _wake_pending(false), _idle_timeout(0), _write_timeout(0), _request_timeout(0),
+     _wheel(clock_ms()), _now(clock_ms()), _next_request(0), _spare_fd(-1), _accepted(0),
+     _rejected(0), _backlog_overflows(0), _overflow_logged_at(0), _thread(this) {
 }
 
 int PollServer::start() {
   _listen();
 
+  _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wake_fd == -1) {
+    throw SocketFailException("eventfd");
+  }
+  PollManager::get_instance().watch(_wake_fd, FD_MODE::READ);
   PollManager::get_instance().watch(_sock, FD_MODE::READ);
+  _spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  // tasks may have been scheduled before there was anything to wake
+  _wake_pending = false;
+  _wake();
   _thread.start();
   return 0;
 }
 
 void PollServer::loop() {
-  struct sockaddr_storage remote_client;
-  socklen_t addrlen = sizeof(remote_client);
-
   std::vector<int> read_fds;
   std::vector<int> write_fds;
   while( !_stop ) {
     read_fds.clear();
     write_fds.clear();
-    PollManager::get_instance().poll(read_fds, write_fds);
+
+    // the select span goes to a sampled message this pass reads, if any,
+    // passes don't take part in the sampling of requests
+    Tracer& tracer = Tracer::get_instance();
+    uint64_t select_start = tracer.enabled() ? Tracer::now() : 0;
+    PollManager::get_instance().poll(read_fds, write_fds, _wheel.next_timeout(clock_ms()));
+    uint64_t select_end = select_start ? Tracer::now() : 0;
+    uint64_t select_trace = 0;
+    // timers due run first, and what is scheduled below counts from now
+    _now = clock_ms();
+    _wheel.advance(_now);
 
     auto it = read_fds.begin();
     for(; it != read_fds.end(); it ++) {
-      if (*it != _sock)  {
+      if (*it == _wake_fd) {
+        _drain_outgoing();
+      } else if (*it != _sock)  {
         // A watched connection finish reading a packet
         // Check if the channel is alive or not
         if (_channels.count(*it) == 0) {
@@ -262,45 +490,426 @@ void PollServer::loop() {
           continue;
         }
         Channel::State state = _channels[*it]->read();
+        if (state == Channel::State::READ_PENDING || state == Channel::State::READ_READY) {
+          _channels[*it]->timers().last_active = _now;
+          if (select_trace == 0) {
+            select_trace = _channels[*it]->trace_id();
+          }
+        }
 
         if (state == Channel::State::READ_READY) {
           // Finish read entire message
           LOG(DEBUG) << "Channel finish reading message" << std::endl;
-          _add_job_wrapper(_channels[*it]);
+          if (_channels[*it]->uploading()) {
+            _channels[*it]->push_frame();
+          } else {
+            _channels[*it]->hold();
+            _add_job_wrapper(_channels[*it]);
+          }
         } else if (state == Channel::State::CLOSED || state == Channel::State::BROKEN) {
           // Remote client close the connection, so close channel
           LOG(DEBUG) << "Remote client closed the connection" << std::endl;
-          _channels[*it]->close();
-          PollManager::get_instance().unwatch(*it, FD_MODE::READ);
-          PollManager::get_instance().unwatch(*it, FD_MODE::WRITE);
-          delete _channels[*it];
-          _channels.erase(*it);
+          _drop_channel(*it);
           LOG(DEBUG) << *it << " fd, connection close" << std::endl;
         }
       } else {
-        //handle new connection
-        int new_sock = accept(_sock, (struct sockaddr*)& remote_client, &addrlen);
-        if (new_sock == -1) {
-          LOG(FATAL) << "Error when acceting" << std::endl;
-        }
-
-        LOG(DEBUG) << "A new connection " <<  new_sock << std::endl;
-        PollManager::get_instance().watch(new_sock, FD_MODE::READ);
-        _channels[new_sock] = new Channel(new_sock, this);
+        _accept();
       }
     }
+    if (select_start && select_trace) {
+      tracer.record("select", select_start, select_end, select_trace);
+    }
 
     for(it = write_fds.begin(); it != write_fds.end(); it ++ ) {
       if (_channels.count(*it) == 0) {
         continue;
       }
-      Channel::State state = _channels[*it]->write();
-      if (state == Channel::State::WRITE_READY) {
-        LOG(DEBUG) << *it << " fd finish write" << std::endl;
-        PollManager::get_instance().unwatch(*it, FD_MODE::WRITE);
+      _write(_channels[*it]);
+    }
+  }
+  // the reactor alone touches the channels, so it closes them too
+  _close_channels();
+}
+
+/* Take the connections waiting in the accept queue, MAX_ACCEPTS at most so
+ * a reconnect storm doesn't keep the reactor from the connections it has.
+ * The listening socket stays readable for the rest.
+ */
+void PollServer::_accept() {
+  // the kernel drops SYNs while the queue is full, clients retry after 1s
+  bool full = _backlog_full();
+
+  std::vector<int> socks;
+  int n = 0;
+  for(; n < MAX_ACCEPTS; n ++) {
+    int new_sock = accept4(_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (new_sock == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno == EMFILE || errno == ENFILE) {
+        _refuse("out of file descriptors");
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG(INFO) << "Error when accepting: " << strerror(errno) << std::endl;
       }
+      break;
+    }
+    if (new_sock >= FD_SETSIZE) {
+      // select can't watch it
+      ::close(new_sock);
+      _rejected ++;
+      LOG(INFO) << "Refused a connection, fd " << new_sock << " is beyond FD_SETSIZE"
+                << std::endl;
+      continue;
     }
+
+    LOG(DEBUG) << "A new connection " <<  new_sock << std::endl;
+    _options.apply_connection(new_sock, family());
+    Channel* chan = new Channel(new_sock, ++ _next_channel_id, this);
+    chan->timers().last_active = _now;
+    _channels[new_sock] = chan;
+    if (_idle_timeout > 0) {
+      _watch_idle(new_sock, chan->id());
+    }
+    socks.push_back(new_sock);
   }
+
+  PollManager::get_instance().watch_all(socks, FD_MODE::READ);
+  _accepted += socks.size();
+  if (full || (n == MAX_ACCEPTS && _backlog_full())) {
+    _backlog_overflows ++;
+    if (_now - _overflow_logged_at >= OVERFLOW_LOG_MS) {
+      _overflow_logged_at = _now;
+      LOG(INFO) << "Accept queue is full, the kernel drops connections, raise "
+                << "SocketOptions::backlog and net.core.somaxconn ("
+                << _backlog_overflows << " times so far)" << std::endl;
+    }
+  }
+}
+
+/* Without a free fd the connection stays in the accept queue and keeps the
+ * listening socket readable, so accept it on the spare fd and close it.
+ */
+void PollServer::_refuse(const char* why) {
+  if (_spare_fd == -1) {
+    return;
+  }
+  ::close(_spare_fd);
+  int sock = accept(_sock, nullptr, nullptr);
+  if (sock != -1) {
+    ::close(sock);
+    _rejected ++;
+    LOG(INFO) << "Refused a connection, " << why << std::endl;
+  }
+  _spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/* Whether the accept queue is at the listen backlog. Linux reports the
+ * queue length of a tcp listener in tcpi_unacked and the backlog in
+ * tcpi_sacked.
+ */
+bool PollServer::_backlog_full() {
+  if (family() == AF_UNIX) {
+    return false;
+  }
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (getsockopt(_sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return false;
+  }
+  return info.tcpi_sacked != 0 && info.tcpi_unacked >= info.tcpi_sacked;
+}
+
+std::function<void(std::function<void()>)> PollServer::executor() {
+  return [this](std::function<void()> job) {
+    _thread_pool->add(&PollServer::_run_task, this, job);
+  };
+}
+
+void PollServer::schedule(long delay_ms, std::function<void()> fn) {
+  Outgoing out;
+  out.kind = Outgoing::TASK;
+  out.delay_ms = delay_ms;
+  out.task = fn;
+  _post(out);
+}
+
+void PollServer::_post(int sock, uint64_t channel, uint64_t request, FrameBuffer* frame,
+                       uint64_t trace_id, bool last) {
+  Outgoing out;
+  out.kind = last ? Outgoing::LAST_FRAME : Outgoing::FRAME;
+  out.sock = sock;
+  out.channel = channel;
+  out.request = request;
+  out.frame = frame;
+  out.trace_id = trace_id;
+  out.posted_at = trace_id ? Tracer::now() : 0;
+  _post(out);
+}
+
+void PollServer::_post(int sock, uint64_t channel, uint64_t request, const std::string& msg,
+                       uint64_t trace_id, bool last) {
+  FrameBuffer* frame = FramePool::get_instance().acquire();
+  frame->reserve(msg.size());
+  frame->append(msg);
+  frame->finish();
+  _post(sock, channel, request, frame, trace_id, last);
+}
+
+void PollServer::_post_resume(int sock, uint64_t channel) {
+  Outgoing out;
+  out.kind = Outgoing::RESUME_READ;
+  out.sock = sock;
+  out.channel = channel;
+  _post(out);
+}
+
+void PollServer::_post(Outgoing& out) {
+  if (_stop) {
+    // nobody drains the queue any more
+    LOG(DEBUG) << "Server stopped, dropping what a worker posted" << std::endl;
+    FramePool::get_instance().release(out.frame);
+    return;
+  }
+  _outgoing.push(std::move(out));
+  _wake();
+}
+
+void PollServer::_wake() {
+  if (_wake_pending.exchange(true) || _wake_fd == -1) {
+    // the reactor drains the queue before it waits again
+    return;
+  }
+  uint64_t one = 1;
+  if (::write(_wake_fd, &one, sizeof(one)) != sizeof(one)) {
+    LOG(INFO) << "Failed to wake the reactor" << std::endl;
+  }
+}
+
+void PollServer::_drain_outgoing() {
+  uint64_t count = 0;
+  if (::read(_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    LOG(INFO) << "Failed to read the wakeup counter" << std::endl;
+  }
+  // posts from here on wake the reactor again
+  _wake_pending.exchange(false);
+
+  std::vector<Channel*> ready;
+  Outgoing out;
+  while (_outgoing.pop(out)) {
+    if (out.kind == Outgoing::TASK) {
+      std::function<void()> task = std::move(out.task);
+      _wheel.schedule(out.delay_ms, [this, task]() {
+        _thread_pool->add(&PollServer::_run_task, this, task);
+      });
+      continue;
+    }
+
+    Channel* chan = _find(out.sock, out.channel);
+    if (out.kind == Outgoing::RESUME_READ) {
+      if (chan != nullptr) {
+        chan->resume_read();
+      }
+      continue;
+    }
+
+    bool current = true;
+    if (out.kind == Outgoing::LAST_FRAME) {
+      current = _answered(out.request);
+      if (current && chan != nullptr) {
+        chan->timers().in_flight --;
+      }
+    } else if (_request_timeout > 0) {
+      current = _deadlines.count(out.request) != 0;
+    }
+    if (chan == nullptr || !current) {
+      LOG(DEBUG) << "Drop frame of request " << out.request << " for channel "
+                 << out.channel << std::endl;
+      FramePool::get_instance().release(out.frame);
+      continue;
+    }
+    if (out.trace_id) {
+      Tracer::get_instance().record("completion queue", out.posted_at, Tracer::now(),
+                                    out.trace_id);
+    }
+    if (chan->queue(out.frame, out.trace_id)) {
+      chan->timers().last_write = _now;
+      ready.push_back(chan);
+    }
+  }
+
+  // one writev per channel for everything posted since the last wakeup
+  for(size_t i = 0; i < ready.size(); i ++) {
+    _write(ready[i]);
+  }
+}
+
+/* Write what chan has queued and keep an eye on it if the client doesn't
+ * take it
+ */
+void PollServer::_write(Channel* chan) {
+  uint64_t written = chan->written();
+  Channel::State state = chan->write();
+  Channel::Timers& timers = chan->timers();
+  if (chan->written() != written) {
+    timers.last_active = _now;
+    timers.last_write = _now;
+  }
+
+  if (state == Channel::State::CLOSED) {
+    _drop_channel(chan->sock());
+  } else if (state == Channel::State::WRITE_PENDING && _write_timeout > 0 && timers.stall == 0) {
+    _watch_stall(chan->sock(), chan->id());
+  } else if (state == Channel::State::WRITE_READY) {
+    LOG(DEBUG) << chan->sock() << " fd finish write" << std::endl;
+  }
+}
+
+void PollServer::_drop_channel(int sock) {
+  auto it = _channels.find(sock);
+  if (it == _channels.end()) {
+    return;
+  }
+  Channel* chan = it->second;
+  _channels.erase(it);
+
+  chan->close();
+  PollManager::get_instance().unwatch(sock, FD_MODE::READ);
+  PollManager::get_instance().unwatch(sock, FD_MODE::WRITE);
+  _wheel.cancel(chan->timers().idle);
+  _wheel.cancel(chan->timers().stall);
+  if (chan->release()) {
+    delete chan;
+  }
+}
+
+void PollServer::_run_task(std::function<void()> task) {
+  try {
+    task();
+  } catch(std::exception& e) {
+    LOG(INFO) << "Scheduled task failed: " << e.what() << std::endl;
+  } catch(...) {
+    LOG(INFO) << "Scheduled task failed" << std::endl;
+  }
+}
+
+void PollServer::_watch_idle(int sock, uint64_t channel) {
+  Channel* chan = _find(sock, channel);
+  chan->timers().idle = _wheel.schedule(_idle_timeout, [this, sock, channel]() {
+    _check_idle(sock, channel);
+  });
+}
+
+void PollServer::_watch_stall(int sock, uint64_t channel) {
+  Channel* chan = _find(sock, channel);
+  chan->timers().stall = _wheel.schedule(_write_timeout, [this, sock, channel]() {
+    _check_stall(sock, channel);
+  });
+}
+
+/* Close the channel if it stayed quiet, or look again when it could have */
+void PollServer::_check_idle(int sock, uint64_t channel) {
+  Channel* chan = _find(sock, channel);
+  if (chan == nullptr) {
+    return;
+  }
+  Channel::Timers& timers = chan->timers();
+  timers.idle = 0;
+
+  uint64_t quiet = _now - timers.last_active;
+  if (quiet >= (uint64_t)_idle_timeout && timers.in_flight == 0 && !chan->writing()) {
+    LOG(DEBUG) << "Close idle connection " << sock << std::endl;
+    _drop_channel(sock);
+    return;
+  }
+
+  long wait = quiet < (uint64_t)_idle_timeout ? _idle_timeout - (long)quiet : _idle_timeout;
+  timers.idle = _wheel.schedule(wait, [this, sock, channel]() {
+    _check_idle(sock, channel);
+  });
+}
+
+/* Close the channel if nothing it queued went out for a while */
+void PollServer::_check_stall(int sock, uint64_t channel) {
+  Channel* chan = _find(sock, channel);
+  if (chan == nullptr) {
+    return;
+  }
+  Channel::Timers& timers = chan->timers();
+  timers.stall = 0;
+  if (!chan->writing()) {
+    return;
+  }
+
+  uint64_t quiet = _now - timers.last_write;
+  if (quiet >= (uint64_t)_write_timeout) {
+    LOG(INFO) << "Close connection " << sock << ", its client stopped reading" << std::endl;
+    _drop_channel(sock);
+    return;
+  }
+  timers.stall = _wheel.schedule(_write_timeout - (long)quiet, [this, sock, channel]() {
+    _check_stall(sock, channel);
+  });
+}
+
+void PollServer::_start_deadline(Channel* chan, uint64_t request) {
+  Deadline deadline;
+  deadline.sock = chan->sock();
+  deadline.channel = chan->id();
+  chan->message_ids(deadline.clientno, deadline.messageid);
+  deadline.timer = _wheel.schedule(_request_timeout, [this, request]() {
+    _expire(request);
+  });
+  _deadlines[request] = deadline;
+}
+
+/* The response of request arrived. False if its deadline passed already,
+ * the client got an error instead.
+ */
+bool PollServer::_answered(uint64_t request) {
+  if (_request_timeout <= 0) {
+    return true;
+  }
+  auto it = _deadlines.find(request);
+  if (it == _deadlines.end()) {
+    return false;
+  }
+  _wheel.cancel(it->second.timer);
+  _deadlines.erase(it);
+  return true;
+}
+
+void PollServer::_expire(uint64_t request) {
+  auto it = _deadlines.find(request);
+  if (it == _deadlines.end()) {
+    return;
+  }
+  Deadline deadline = it->second;
+  _deadlines.erase(it);
+
+  Channel* chan = _find(deadline.sock, deadline.channel);
+  if (chan == nullptr) {
+    return;
+  }
+  LOG(INFO) << "Message " << deadline.messageid << " of client " << deadline.clientno
+            << " passed its deadline" << std::endl;
+  chan->timers().in_flight --;
+
+  FrameBuffer* frame = FramePool::get_instance().acquire();
+  Proto::write_error(Proto::DEADLINE_EXCEEDED, *frame, deadline.clientno, deadline.messageid);
+  if (chan->queue(frame)) {
+    chan->timers().last_write = _now;
+    _write(chan);
+  }
+}
+
+/* The channel the post was for, nullptr if it was closed meanwhile */
+Channel* PollServer::_find(int sock, uint64_t channel) {
+  auto it = _channels.find(sock);
+  if (it == _channels.end() || it->second->id() != channel) {
+    return nullptr;
+  }
+  return it->second;
 }
 
 void PollServer::_close_channels() {
@@ -313,9 +922,12 @@ void PollServer::_close_channels() {
   _channels.clear();
 }
 
+/* The reactor closes the connections on its way out */
 int PollServer::stop() {
-  _close_channels();
   _stop = true;
+  if (_wake_fd != -1) {
+    _wake();
+  }
   return 0;
 }
 
@@ -323,17 +935,67 @@ PollServer::~PollServer() {
   if (_stop == false) {
     stop();
   }
+  if (_thread.is_active()) {
+    _thread.join();
+  } else {
+    _close_channels();
+  }
+  // workers and the completions they run post to the queue and the
+  // eventfd below, let them finish first. Their posts are dropped now.
+  _thread_pool.reset();
+
+  if (_wake_fd != -1) {
+    int wake_fd = _wake_fd;
+    _wake_fd = -1;
+    PollManager::get_instance().unwatch(wake_fd, FD_MODE::READ);
+    ::close(wake_fd);
+  }
+  if (_spare_fd != -1) {
+    ::close(_spare_fd);
+  }
+
+  // frames the reactor didn't get to
+  Outgoing out;
+  while (_outgoing.pop(out)) {
+    FramePool::get_instance().release(out.frame);
+  }
 }
 
 void PollServer::_add_job_wrapper(Channel* chan) {
-  _thread_pool.add(&PollServer::_handle_request, this, chan);
+  uint64_t request = ++ _next_request;
+  chan->set_request(request);
+  chan->timers().in_flight ++;
+  if (_request_timeout > 0) {
+    _start_deadline(chan, request);
+  }
+  chan->mark_queued();
+  _queued ++;
+  _thread_pool->add(&PollServer::_handle_request, this, chan);
 }
 
 void PollServer::_handle_request(Channel* chan) {
+  _queued --;
+  Tracer& tracer = Tracer::get_instance();
+  uint64_t trace_id = chan->trace_id();
+  uint64_t t = trace_id ? Tracer::now() : 0;
+  if (trace_id) {
+    tracer.record("ThreadPool::queue", chan->queued_at(), t, trace_id);
+  }
+
+  // the channel may be gone by the time the response is ready, the
+  // reactor finds it by socket and id
+  int sock = chan->sock();
+  uint64_t channel = chan->id();
+  uint64_t req_no = chan->request();
+
+  bool cleared = false;
+  bool dropped = false;
+  bool upload = false;
+  int clientno = -1;
+  int messageid = -1;
   try {
     LOG(DEBUG) << "Start to handle request" << std::endl;
     std::string msg = chan->get_msg();
-    chan->clear_msg();
 
     if (msg == "") {
       throw ServerBadMessageException();
@@ -341,18 +1003,62 @@ void PollServer::_handle_request(Channel* chan) {
 
     LOG(DEBUG) << "get message " << msg.c_str() << std::endl;
     Request request = Proto::build_request(msg); // could throw json parse exception
-    int r = _handler->on_request(&request);
+    clientno = request.clientno();
+    messageid = request.messageid();
+    if (trace_id) {
+      tracer.record("Proto::build_request", t, Tracer::now(), trace_id);
+    }
 
-    if (r == 0) {
-      throw ServerMethodNotFoundException();
+    // frames after an upload request belong to it, so route them before
+    // the reactor reads on
+    if (request.upload()) {
+      upload = true;
+      chan->start_upload();
+      request.set_source([chan](std::string& frame) {
+        return chan->next_frame(frame);
+      });
     }
+    dropped = chan->clear_msg();
+    cleared = true;
 
-    msg = Proto::build_response(request.get_response());
-    LOG(DEBUG) << "send back msg " << msg.c_str() << std::endl;
-    chan->send(msg);
+    request.get_response().set_sink([this, sock, channel, req_no, trace_id](const std::string& frame) {
+      _post(sock, channel, req_no, frame, trace_id, false);
+    });
+    // a deferred response is posted by the thread completing it
+    request.set_completion([this, sock, channel, req_no, trace_id](Request& req,
+                                                                  std::exception_ptr error) {
+      FrameBuffer* frame = FramePool::get_instance().acquire();
+      _complete(req, *frame, error);
+      _post(sock, channel, req_no, frame, trace_id, true);
+    });
+
+    // the response is written in place behind its length prefix and the
+    // channel sends that buffer as is
+    FrameBuffer* frame = FramePool::get_instance().acquire();
+    bool ready = false;
+    try {
+      ready = _respond(request, *frame, trace_id);
+    } catch(...) {
+      FramePool::get_instance().release(frame);
+      throw;
+    }
+    if (ready) {
+      LOG(DEBUG) << "send back msg of " << frame->payload_size() << " bytes" << std::endl;
+      _post(sock, channel, req_no, frame, trace_id, true);
+    } else {
+      // the completion of the request sends it
+      FramePool::get_instance().release(frame);
+    }
   } catch(ServerException& e) {
     LOG(DEBUG) << e.what() << std::endl;
-    std::string err_msg = Proto::build_error(e.get_code());
-    chan->send(err_msg);
+    if (!cleared) {
+      dropped = chan->clear_msg();
+    }
+    std::string err_msg = Proto::build_error(e.get_code(), clientno, messageid);
+    _post(sock, channel, req_no, err_msg, trace_id, true);
+  }
+
+  if (dropped || (upload && chan->finish_upload())) {
+    delete chan;
   }
 }
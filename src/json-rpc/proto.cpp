@@ -1,12 +1,14 @@
 #include "json-rpc/proto.hpp"
 #include "json-rpc/errors.hpp"
+#include "json-rpc/numarray.hpp"
 
 /**
  * Parse message to return a request and handler id
  */
 Request Proto::build_request(std::string msg) {
+  std::string attachments;
   PError err;
-  JValue* req_json = loads(msg, err);
+  JValue* req_json = loads(split_frame(msg, &attachments), err);
 
   // check json integrity
   if (req_json == nullptr || !req_json->isObject()) {
@@ -62,36 +64,224 @@ Request Proto::build_request(std::string msg) {
   }
 
   Request request(clientno, serverno, version, timestamp, messageid, handlerid, item_json, req_json);
+  request.set_attachments(std::move(attachments));
+
+  // the clients write params as the last key, the text of the array is
+  // what ResultCache keys on
+  static const std::string ParamKey = "\"" + Param + "\":";
+  size_t json_end = std::min(msg.find('\0'), msg.size());
+  size_t params_at = msg.find(ParamKey);
+  if (params_at != std::string::npos && json_end >= 2 && params_at < json_end) {
+    size_t begin = params_at + ParamKey.size();
+    size_t end = json_end - 1;
+    if (begin < end && msg[begin] == '[' && msg[end - 1] == ']' && msg[end] == '}') {
+      request.set_raw(std::move(msg), begin, end - begin);
+    }
+  }
+
+  // chunk frames of an uploaded argument follow
+  item_json = req_json->get(Upload);
+  if (item_json != nullptr && item_json->isInteger() && item_json->getInteger() != 0) {
+    request.set_upload(true);
+  }
   return request;
 }
 
+static void write_content(FrameBuffer& out, JValue* content) { write_json(out, content); }
+static void write_content(std::string& out, JValue* content) { write_json(out, content); }
+static void write_content(FrameBuffer& out, const std::string& text) { out.append(text); }
+static void write_content(std::string& out, const std::string& text) { out.append(text); }
+
+/**
+ * Write {"clientno":..,"messageid":..,"key":content} followed by the
+ * attachment section, content is either a json tree or text already encoded.
+ * The ids are left out if messageid is negative.
+ */
+template<class Out, class Content>
+static void write_envelope(Out& out, const std::string& key, const Content& content,
+                           const std::string& attachments, int clientno = -1,
+                           int messageid = -1) {
+  out.push_back('{');
+  if (messageid >= 0) {
+    std::string ids = "\"" + ClientNo + "\":";
+    numeric::append(ids, (long long)clientno);
+    ids.append(",\"" + MessageId + "\":");
+    numeric::append(ids, (long long)messageid);
+    ids.push_back(',');
+    out.append(ids);
+  }
+  out.push_back('"');
+  out.append(key);
+  out.append("\":", 2);
+  write_content(out, content);
+  out.push_back('}');
+  if (!attachments.empty()) {
+    out.push_back('\0');
+    out.append(attachments);
+  }
+}
+
 /**
  * Build a response text based on result from server method
  */
 std::string Proto::build_response(Response& resp) {
-  JObject* obj = new JObject();
-  obj->put(Result, resp.get_serializer().getContent());
+  if (resp.raw_frame()) {
+    return *resp.raw_frame();
+  }
+  std::string jsonText;
+  if (resp.raw_result()) {
+    write_envelope(jsonText, Result, *resp.raw_result(), resp.attachments(),
+                   resp.clientno(), resp.messageid());
+    return jsonText;
+  }
 
-  std::string jsonText = dumps(obj);
-  delete obj;
+  JValue* content = resp.get_serializer().getContent();
+  write_envelope(jsonText, Result, content, resp.attachments(), resp.clientno(), resp.messageid());
+  delete content;
   return jsonText; 
 }
 
 /**
- * Build an error message given error code
+ * Write the response frame, length prefix included, straight into frame
  */
-std::string Proto::build_error(int code) {
+void Proto::write_response(Response& resp, FrameBuffer& frame) {
+  frame.clear();
+  if (resp.raw_frame()) {
+    frame.append(*resp.raw_frame());
+    frame.finish();
+    return;
+  }
+  if (resp.raw_result()) {
+    write_envelope(frame, Result, *resp.raw_result(), resp.attachments(),
+                   resp.clientno(), resp.messageid());
+    frame.finish();
+    return;
+  }
+
+  JValue* content = resp.get_serializer().getContent();
+  write_envelope(frame, Result, content, resp.attachments(), resp.clientno(), resp.messageid());
+  frame.finish();
+  delete content;
+}
+
+/**
+ * Build one frame of a streamed response
+ */
+std::string Proto::build_chunk(OutSerializer& sout, const std::string& attachments) {
+  JValue* content = sout.getContent();
+  std::string jsonText;
+  write_envelope(jsonText, Chunk, content, attachments);
+  delete content;
+  return jsonText;
+}
+
+/**
+ * Build the frame ending an upload
+ */
+std::string Proto::build_end() {
   JObject* obj = new JObject();
-  obj->put(Error, code);
+  obj->put(End, 1);
 
   std::string jsonText = dumps(obj);
   delete obj;
   return jsonText;
 }
 
-JValue* Proto::parse_response(std::string response) {
+/**
+ * Check if frame ends an upload. The end frame is tiny, so chunk frames
+ * are told apart by their size without parsing them
+ */
+bool Proto::is_end(const std::string& frame) {
+  if (frame.size() > 16) {
+    return false;
+  }
+
   PError err;
-  JValue* json_resp = loads(response, err);
+  JValue* json = loads(frame, err);
+  bool end = json != nullptr && json->isObject() && json->contain(End);
+  if (json) delete json;
+  return end;
+}
+
+/**
+ * Read the leading integer members of a request or response object up to
+ * clientno and messageid, which the envelopes write first
+ */
+bool Proto::message_ids(const char* text, size_t len, int& clientno, int& messageid) {
+  const char* p = text;
+  const char* end = text + len;
+  if (p == end || *p != '{') {
+    return false;
+  }
+  p ++;
+
+  bool has_clientno = false;
+  while (p < end && *p == '"') {
+    const char* name = ++ p;
+    while (p < end && *p != '"') p ++;
+    if (p + 1 >= end || p[1] != ':') {
+      return false;
+    }
+    std::string member(name, p - name);
+    p += 2;
+
+    bool negative = p < end && *p == '-';
+    if (negative) p ++;
+    if (p == end || *p < '0' || *p > '9') {
+      return false;
+    }
+    long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      value = value * 10 + (*p ++ - '0');
+    }
+    if (negative) value = -value;
+
+    if (member == ClientNo) {
+      clientno = (int)value;
+      has_clientno = true;
+    } else if (member == MessageId) {
+      if (!has_clientno) {
+        return false;
+      }
+      messageid = (int)value;
+      return true;
+    }
+
+    if (p == end || *p != ',') {
+      return false;
+    }
+    p ++;
+  }
+  return false;
+}
+
+/**
+ * Build an error message given error code, and the ids of the request if it
+ * got that far
+ */
+std::string Proto::build_error(int code, int clientno, int messageid) {
+  // written like responses, ids first, so MuxClient finds them the same way
+  std::string content;
+  numeric::append(content, (long long)code);
+  std::string jsonText;
+  write_envelope(jsonText, Error, content, std::string(), clientno, messageid);
+  return jsonText;
+}
+
+/**
+ * Write the error frame, length prefix included, straight into frame
+ */
+void Proto::write_error(int code, FrameBuffer& frame, int clientno, int messageid) {
+  std::string content;
+  numeric::append(content, (long long)code);
+  frame.clear();
+  write_envelope(frame, Error, content, std::string(), clientno, messageid);
+  frame.finish();
+}
+
+JValue* Proto::parse_response(std::string response, std::string* attachments) {
+  PError err;
+  JValue* json_resp = loads(split_frame(response, attachments), err);
   if (json_resp == nullptr) {
     LOG(FATAL) << VarString::format("Json parse error, json text[%s], error text[%s]",
                     response.c_str(), err.text.c_str()) << std::endl;
@@ -102,6 +292,15 @@ JValue* Proto::parse_response(std::string response) {
                     response.c_str()) << std::endl;
   }
 
+  check_response(json_resp);
+  return json_resp;
+}
+
+/**
+ * Throw the exception matching the error code if the response carries one.
+ * The response is deleted in that case.
+ */
+void Proto::check_response(JValue* json_resp) {
   if (json_resp->contain(Error) ) {
     int errcode = json_resp->get(Error)->getInteger();
     switch(errcode) {
@@ -126,17 +325,25 @@ JValue* Proto::parse_response(std::string response) {
         LOG(DEBUG) << "Message sent out was broken" << std::endl;
         delete json_resp;
         throw ServerBadMessageException();
+      case HANDLER_FAILED:
+        LOG(DEBUG) << "Handler of the method failed" << std::endl;
+        delete json_resp;
+        throw ServerHandlerFailedException();
+      case DEADLINE_EXCEEDED:
+        LOG(DEBUG) << "Server gave up on the request" << std::endl;
+        delete json_resp;
+        throw ServerDeadlineExceededException();
       default:
         LOG(FATAL) << "Unknown error code " << errcode << std::endl;
     }
   }
-  return json_resp;
 }
 
 std::string Proto::build_request(
                      int clientno, int serverno,
                      int messageid, long timestamp,
-                     size_t method_hash, OutSerializer& sout) {
+                     size_t method_hash, OutSerializer& sout,
+                     bool upload, const std::string& attachments) {
   JObject* obj = new JObject();
   obj->put(ClientNo, clientno);
   obj->put(ServerNo, serverno);
@@ -145,8 +352,12 @@ std::string Proto::build_request(
   obj->put(MessageId, messageid);
   obj->put(Method, method_hash);
   obj->put(Param, sout.getContent());
+  if (upload) {
+    obj->put(Upload, 1);
+  }
 
   std::string msg = dumps(obj);
   delete obj;
+  join_frame(msg, attachments);
   return msg;
 }
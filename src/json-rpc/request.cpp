@@ -1,15 +1,123 @@
 #include "json-rpc/server/request.hpp"
+#include "json-rpc/proto.hpp"
+#include "json-rpc/errors.hpp"
 
 Request::Request(int clientno, int serverno, int version, long timestamp,
         int messageid, size_t handlerid, JValue* array, JValue* msg_json)
     :_clientno(clientno), _serverno(serverno), _version(version),
      _timestamp(timestamp), _messageid(messageid), _handlerid(handlerid),
-     _sin(array), _msg_json(msg_json) {
+     _sin(array), _msg_json(msg_json), _params_offset(0), _params_len(0), _raw_hash(0),
+     _upload(false), _upload_done(false), _deferred(false) {
+  _resp.set_ids(clientno, messageid);
 }
 
 Request::Request(Request&& o)
     :_clientno(o._clientno), _serverno(o._serverno), _version(o._version),
      _timestamp(o._timestamp), _messageid(o._messageid), _handlerid(o._handlerid),
-     _sin(std::move(o._sin)), _msg_json(std::move(o._msg_json)) {
+     _sin(std::move(o._sin)), _msg_json(std::move(o._msg_json)),
+     _attachments(std::move(o._attachments)),
+     _raw(std::move(o._raw)), _params_offset(o._params_offset), _params_len(o._params_len),
+     _raw_hash(o._raw_hash),
+     _upload(o._upload), _upload_done(o._upload_done), _source(std::move(o._source)),
+     _completion(std::move(o._completion)), _on_defer(std::move(o._on_defer)),
+     _deferred(false) {
+  o._msg_json = nullptr;
+  _resp.set_ids(_clientno, _messageid);
+  _resp.set_sink(o._resp.sink());
+  _resp.attachments().swap(o._resp.attachments());
 }
 
+JValue* Request::next_chunk(std::string* attachments) {
+  if (!_upload || _upload_done) return nullptr;
+  if (!_source) {
+    throw std::runtime_error("Server connector doesn't support uploads");
+  }
+
+  std::string frame;
+  if (!_source(frame)) {
+    throw ServerCloseSocketException();
+  }
+
+  PError err;
+  JValue* json = loads(split_frame(frame, attachments), err);
+  if (json == nullptr || !json->isObject()) {
+    if (json) delete json;
+    throw ServerJsonNotParsedException();
+  }
+
+  if (!json->contain(Chunk)) {
+    // end of the upload
+    delete json;
+    _upload_done = true;
+    return nullptr;
+  }
+  return json;
+}
+
+void Request::drain_upload() {
+  JValue* chunk;
+  while ((chunk = next_chunk()) != nullptr) {
+    delete chunk;
+  }
+}
+
+std::shared_ptr<Request> Request::defer() {
+  if (!_completion) {
+    throw std::runtime_error("Server connector doesn't support deferred responses");
+  }
+  if (_upload) {
+    throw std::runtime_error("Requests with an uploaded argument can't be deferred");
+  }
+  if (_deferred) {
+    throw std::runtime_error("Request deferred twice");
+  }
+
+  std::function<void()> on_defer = _on_defer;
+  std::shared_ptr<Request> owned(new Request(std::move(*this)));
+  _deferred = true;
+  if (on_defer) {
+    on_defer();
+  }
+  return owned;
+}
+
+void Request::complete(std::exception_ptr error) {
+  if (!_completion) {
+    throw std::runtime_error("Request wasn't deferred");
+  }
+  Completion completion = std::move(_completion);
+  _completion = nullptr;
+  completion(*this, error);
+}
+
+uint64_t Request::raw_hash() {
+  if (_raw_hash != 0) {
+    return _raw_hash;
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  const unsigned char* p = (const unsigned char*)&_handlerid;
+  for(size_t i = 0; i < sizeof(_handlerid); i ++) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  p = (const unsigned char*)raw_params();
+  for(size_t i = 0; i < _params_len; i ++) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  p = (const unsigned char*)_attachments.data();
+  for(size_t i = 0; i < _attachments.size(); i ++) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  _raw_hash = hash;
+  return hash;
+}
+
+std::shared_ptr<const std::string> Response::encode_result() {
+  if (!_raw_result) {
+    std::shared_ptr<std::string> text(new std::string());
+    JValue* content = _sout.getContent();
+    write_json(*text, content);
+    delete content;
+    _raw_result = text;
+  }
+  return _raw_result;
+}
@@ -0,0 +1,109 @@
+#include "json-rpc/server/resultcache.hpp"
+
+#include <chrono>
+
+ResultCache::ResultCache(long ttl_ms, size_t max_entries) : _ttl_ms(ttl_ms) {
+  if (max_entries == 0) {
+    max_entries = 1;
+  }
+  size_t shards = std::min(max_entries, MAX_SHARDS);
+  _shard_capacity = (max_entries + shards - 1) / shards;
+  for(size_t i = 0; i < shards; i ++) {
+    _shards.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+bool ResultCache::lookup(Request& req, Key& key) {
+  if (req.raw_params_size() == 0) {
+    return false;
+  }
+
+  key.hash = req.raw_hash();
+  key.valid = true;
+
+  std::shared_ptr<const Result> result;
+  {
+    Shard& shard = _shard(key.hash);
+    std::lock_guard<std::mutex> _(shard.mutex);
+    auto it = shard.index.find(key.hash);
+    if (it == shard.index.end()) {
+      return false;
+    }
+
+    Entry& entry = *it->second;
+    if (entry.expires_at <= _now_ms()) {
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+      return false;
+    }
+    if (entry.method != req.handlerid() ||
+        entry.params.compare(0, std::string::npos, req.raw_params(), req.raw_params_size()) != 0 ||
+        entry.attachments != req.attachments()) {
+      return false;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    result = entry.result;
+  }
+
+  Response& resp = req.get_response();
+  resp.set_raw_result(result->text);
+  resp.attachments() = result->attachments;
+  return true;
+}
+
+void ResultCache::store(const Key& key, Request& req) {
+  if (!key.valid) {
+    return;
+  }
+
+  // encode the result once, the response sends this text from now on
+  Response& resp = req.get_response();
+  std::shared_ptr<Result> result(new Result());
+  result->text = resp.encode_result();
+  result->attachments = resp.attachments();
+
+  Entry entry;
+  entry.hash = key.hash;
+  entry.method = req.handlerid();
+  entry.params.assign(req.raw_params(), req.raw_params_size());
+  entry.attachments = req.attachments();
+  entry.expires_at = _now_ms() + _ttl_ms;
+  entry.result = result;
+
+  Shard& shard = _shard(key.hash);
+  std::lock_guard<std::mutex> _(shard.mutex);
+  auto it = shard.index.find(key.hash);
+  if (it != shard.index.end()) {
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+  }
+  while (shard.lru.size() >= _shard_capacity) {
+    shard.index.erase(shard.lru.back().hash);
+    shard.lru.pop_back();
+  }
+  shard.lru.push_front(std::move(entry));
+  shard.index[key.hash] = shard.lru.begin();
+}
+
+size_t ResultCache::size() {
+  size_t count = 0;
+  for(size_t i = 0; i < _shards.size(); i ++) {
+    std::lock_guard<std::mutex> _(_shards[i]->mutex);
+    count += _shards[i]->lru.size();
+  }
+  return count;
+}
+
+void ResultCache::clear() {
+  for(size_t i = 0; i < _shards.size(); i ++) {
+    std::lock_guard<std::mutex> _(_shards[i]->mutex);
+    _shards[i]->lru.clear();
+    _shards[i]->index.clear();
+  }
+}
+
+uint64_t ResultCache::_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,119 @@
+#include "json-rpc/client/shmclient.hpp"
+#include "json-rpc/errors.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+ShmClient::ShmClient(UnixPath path, size_t capacity)
+    :_path(path.path), _capacity(capacity),
+     _sock(UNINIT_SOCKET), _segment(nullptr) {
+  struct sockaddr_un addr;
+  if (!unix_addr(_path, addr)) {
+    throw HostFailException("Unix socket path too long", "unix", _path);
+  }
+}
+
+ShmClient::~ShmClient() {
+  _close();
+}
+
+void ShmClient::_close() {
+  if (_segment) {
+    delete _segment;
+    _segment = nullptr;
+  }
+  if (_sock != UNINIT_SOCKET) {
+    close(_sock);
+    _sock = UNINIT_SOCKET;
+  }
+}
+
+void ShmClient::reconnect() {
+  _close();
+
+  struct sockaddr_un addr;
+  unix_addr(_path, addr);
+  _sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_sock == UNINIT_SOCKET) {
+    throw SocketFailException("socket");
+  }
+  if (connect(_sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_un)) != 0) {
+    LOG(DEBUG) << "Can't connect to server" << std::endl;
+    _close();
+    throw HostFailException("Can't connect", "unix", _path);
+  }
+
+  _segment = new ShmSegment();
+  if (!_segment->create(_capacity) || !_segment->send_to(_sock)) {
+    _close();
+    throw HostFailException("Can't set up shared memory", "unix", _path);
+  }
+
+  // server acks once it has mapped the segment
+  char ack = 0;
+  if (read(_sock, &ack, 1) != 1) {
+    _close();
+    throw HostFailException("Shared memory handshake failed", "unix", _path);
+  }
+
+  _segment->bind(ShmSegment::CLIENT, _sock);
+  LOG(DEBUG) << "connect to server through shared memory" << std::endl;
+}
+
+void ShmClient::send_and_response(std::string message, std::string& result) {
+  if (_segment == nullptr) {
+    reconnect();
+  }
+
+  if (!_segment->out().write_frame(message)) {
+    LOG(INFO) << "write to shared memory ring failed" << std::endl;
+    _close();
+    throw WriteFailException();
+  }
+
+  if (!_segment->in().read_frame(result)) {
+    LOG(INFO) << "read from shared memory ring failed" << std::endl;
+    _close();
+    throw ReadFailException();
+  }
+}
+
+void ShmClient::send_and_stream(std::string message, std::function<bool(std::string&)> on_frame) {
+  if (_segment == nullptr) {
+    reconnect();
+  }
+
+  if (!_segment->out().write_frame(message)) {
+    _close();
+    throw WriteFailException();
+  }
+
+  std::string frame;
+  do {
+    if (!_segment->in().read_frame(frame)) {
+      _close();
+      throw ReadFailException();
+    }
+  } while (on_frame(frame));
+}
+
+void ShmClient::stream_and_response(std::string message, std::function<bool(std::string&)> next_frame,
+                                    std::string& result) {
+  if (_segment == nullptr) {
+    reconnect();
+  }
+
+  std::string frame = message;
+  do {
+    if (!_segment->out().write_frame(frame)) {
+      _close();
+      throw WriteFailException();
+    }
+  } while (next_frame(frame));
+
+  if (!_segment->in().read_frame(result)) {
+    _close();
+    throw ReadFailException();
+  }
+}
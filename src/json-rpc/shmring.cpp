@@ -0,0 +1,331 @@
+#include "json-rpc/shmring.hpp"
+#include "json-rpc/util.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const int SPIN_ROUNDS = 2000;
+
+static inline void signal_fd(int fd) {
+  uint64_t one = 1;
+  ssize_t r = ::write(fd, &one, sizeof one);
+  (void)r;
+}
+
+void ShmRing::attach(ShmRingHeader* hdr, char* data, size_t capacity,
+                     int data_fd, int space_fd, int peer) {
+  _hdr = hdr;
+  _data = data;
+  _capacity = capacity;
+  _data_fd = data_fd;
+  _space_fd = space_fd;
+  _peer = peer;
+}
+
+bool ShmRing::write_frame(const std::string& msg) {
+  int size = msg.size();
+  return _write((const char*)&size, sizeof(int)) && _write(msg.c_str(), msg.size());
+}
+
+bool ShmRing::read_frame(std::string& msg) {
+  int size = 0;
+  if (!_read((char*)&size, sizeof(int)) || size <= 0) {
+    return false;
+  }
+  if ((size_t)size > _max_frame) {
+    LOG(INFO) << "Shared memory frame of " << size << " bytes is over the limit" << std::endl;
+    return false;
+  }
+  msg.resize(size);
+  return _read(&msg[0], size);
+}
+
+bool ShmRing::_write(const char* buf, size_t len) {
+  int spin = 0;
+  while (len != 0) {
+    uint64_t head = _hdr->head.load(std::memory_order_relaxed);
+    uint64_t tail = _hdr->tail.load(std::memory_order_acquire);
+    if (head - tail > _capacity) {
+      // the peer can write the header too, don't trust what it left there
+      LOG(INFO) << "Shared memory ring positions are broken" << std::endl;
+      return false;
+    }
+    size_t space = _capacity - (head - tail);
+
+    if (space == 0) {
+      if (spin ++ < SPIN_ROUNDS) continue;
+
+      // announce we sleep, then look again so a read in between is not lost
+      _hdr->writer_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_hdr->tail.load(std::memory_order_acquire) == tail && !_wait(_space_fd)) {
+        _hdr->writer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+      }
+      _hdr->writer_waiting.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    spin = 0;
+
+    size_t n = std::min(space, len);
+    size_t pos = head % _capacity;
+    size_t first = std::min(n, _capacity - pos);
+    memcpy(_data + pos, buf, first);
+    memcpy(_data, buf + first, n - first);
+
+    _hdr->head.store(head + n, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_hdr->reader_waiting.load(std::memory_order_relaxed)) {
+      signal_fd(_data_fd);
+    }
+
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool ShmRing::_read(char* buf, size_t len) {
+  int spin = 0;
+  while (len != 0) {
+    uint64_t tail = _hdr->tail.load(std::memory_order_relaxed);
+    uint64_t head = _hdr->head.load(std::memory_order_acquire);
+    if (head - tail > _capacity) {
+      LOG(INFO) << "Shared memory ring positions are broken" << std::endl;
+      return false;
+    }
+    size_t avail = head - tail;
+
+    if (avail == 0) {
+      if (spin ++ < SPIN_ROUNDS) continue;
+
+      _hdr->reader_waiting.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_hdr->head.load(std::memory_order_acquire) == head && !_wait(_data_fd)) {
+        _hdr->reader_waiting.store(0, std::memory_order_relaxed);
+        return false;
+      }
+      _hdr->reader_waiting.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    spin = 0;
+
+    size_t n = std::min(avail, len);
+    size_t pos = tail % _capacity;
+    size_t first = std::min(n, _capacity - pos);
+    memcpy(buf, _data + pos, first);
+    memcpy(buf + first, _data, n - first);
+
+    _hdr->tail.store(tail + n, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_hdr->writer_waiting.load(std::memory_order_relaxed)) {
+      signal_fd(_space_fd);
+    }
+
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * Sleep until fd is signaled. Returns false if the control socket hangs up
+ * in the meantime, meaning the peer is gone.
+ **/
+bool ShmRing::_wait(int fd) {
+  struct pollfd fds[2];
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = _peer;
+  fds[1].events = POLLIN;
+
+  while (true) {
+    int r = ::poll(fds, 2, -1);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    if (fds[1].revents != 0) {
+      char c;
+      if (recv(_peer, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+        return false;
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      uint64_t value;
+      ssize_t n = ::read(fd, &value, sizeof value);
+      (void)n;
+      return true;
+    }
+  }
+}
+
+ShmSegment::ShmSegment()
+    : _memfd(-1), _base(nullptr), _length(0), _capacity(0) {
+  for(int i = 0; i < EVENT_FDS; i ++) {
+    _efds[i] = -1;
+  }
+}
+
+ShmSegment::~ShmSegment() {
+  if (_base) {
+    munmap(_base, _length);
+  }
+  if (_memfd != -1) {
+    close(_memfd);
+  }
+  for(int i = 0; i < EVENT_FDS; i ++) {
+    if (_efds[i] != -1) close(_efds[i]);
+  }
+}
+
+bool ShmSegment::create(size_t capacity) {
+  _capacity = capacity;
+  _length = 2 * sizeof(ShmRingHeader) + 2 * _capacity;
+
+  // sealed at its size, so the server can rely on it after checking
+  _memfd = memfd_create("json-rpc-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (_memfd == -1 || ftruncate(_memfd, _length) != 0 ||
+      fcntl(_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    LOG(INFO) << "Can't create shared memory segment" << std::endl;
+    return false;
+  }
+
+  for(int i = 0; i < EVENT_FDS; i ++) {
+    _efds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_efds[i] == -1) {
+      return false;
+    }
+  }
+
+  if (!_map()) return false;
+
+  ShmRingHeader* hdr = (ShmRingHeader*)_base;
+  for(int i = 0; i < 2; i ++) {
+    ShmRingHeader* h = new (&hdr[i]) ShmRingHeader();
+    h->head.store(0);
+    h->tail.store(0);
+    h->reader_waiting.store(0);
+    h->writer_waiting.store(0);
+  }
+  return true;
+}
+
+bool ShmSegment::_map() {
+  _base = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, _memfd, 0);
+  if (_base == MAP_FAILED) {
+    _base = nullptr;
+    LOG(INFO) << "Can't map shared memory segment" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ShmSegment::send_to(int sock) {
+  int fds[EVENT_FDS + 1];
+  fds[0] = _memfd;
+  memcpy(fds + 1, _efds, sizeof _efds);
+
+  uint64_t capacity = _capacity;
+  struct iovec iov;
+  iov.iov_base = &capacity;
+  iov.iov_len = sizeof capacity;
+
+  char control[CMSG_SPACE(sizeof fds)];
+  memset(control, 0, sizeof control);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+  return sendmsg(sock, &msg, 0) == (ssize_t)sizeof capacity;
+}
+
+bool ShmSegment::recv_from(int sock) {
+  int fds[EVENT_FDS + 1];
+  uint64_t capacity = 0;
+  struct iovec iov;
+  iov.iov_base = &capacity;
+  iov.iov_len = sizeof capacity;
+
+  char control[CMSG_SPACE(sizeof fds)];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+
+  ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  struct cmsghdr* cmsg = len < 0 ? nullptr : CMSG_FIRSTHDR(&msg);
+  if (len != (ssize_t)sizeof capacity || (msg.msg_flags & MSG_CTRUNC) != 0 ||
+      cmsg == nullptr || CMSG_NXTHDR(&msg, cmsg) != nullptr ||
+      cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof fds)) {
+    LOG(INFO) << "Shared memory handshake without the expected descriptors" << std::endl;
+    // whatever descriptors came along would leak otherwise
+    for(; len >= 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(size_t i = 0; i < count; i ++) {
+          int fd;
+          memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+          close(fd);
+        }
+      }
+    }
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+
+  // owned from here on, the destructor closes them
+  _memfd = fds[0];
+  memcpy(_efds, fds + 1, sizeof _efds);
+
+  // the client picks the capacity, the segment has to hold both rings
+  if (capacity == 0 || capacity > (SIZE_MAX / 2 - sizeof(ShmRingHeader)) / 2) {
+    LOG(INFO) << "Shared memory capacity " << capacity << " is out of range" << std::endl;
+    return false;
+  }
+  _capacity = capacity;
+  _length = 2 * sizeof(ShmRingHeader) + 2 * _capacity;
+
+  struct stat st;
+  int seals = fcntl(_memfd, F_GET_SEALS);
+  if (fstat(_memfd, &st) != 0 || st.st_size < 0 || (size_t)st.st_size < _length ||
+      seals == -1 || (seals & F_SEAL_SHRINK) == 0) {
+    LOG(INFO) << "Shared memory segment is smaller than its rings, or can shrink" << std::endl;
+    return false;
+  }
+  return _map();
+}
+
+void ShmSegment::bind(Side side, int peer) {
+  ShmRingHeader* hdr = (ShmRingHeader*)_base;
+  char* data = (char*)_base + 2 * sizeof(ShmRingHeader);
+
+  ShmRing& req = side == CLIENT ? _out : _in;
+  ShmRing& resp = side == CLIENT ? _in : _out;
+  req.attach(&hdr[0], data, _capacity, _efds[REQ_DATA], _efds[REQ_SPACE], peer);
+  resp.attach(&hdr[1], data + _capacity, _capacity, _efds[RESP_DATA], _efds[RESP_SPACE], peer);
+}
@@ -0,0 +1,114 @@
+#include "json-rpc/server/shmserver.hpp"
+#include "json-rpc/proto.hpp"
+
+ShmServer::ShmServer(UnixPath path)
+    : ServerConnector(path), _stop(false), _max_frame(64 * 1024 * 1024), _thread(this) {
+  _sessions.clear();
+}
+
+ShmServer::~ShmServer() {
+  if (!_stop) {
+    stop();
+  }
+}
+
+int ShmServer::start() {
+  _listen();
+  _thread.start();
+  return 0;
+}
+
+int ShmServer::stop() {
+  _stop = true;
+  // wake up the loop thread blocked in accept
+  ::shutdown(_sock, SHUT_RDWR);
+  if (_thread.is_active()) {
+    _thread.join();
+  }
+  _reap_sessions(true);
+  return 0;
+}
+
+void ShmServer::loop() {
+  while (!_stop) {
+    int client_sock = accept(_sock, nullptr, nullptr);
+    if (client_sock == -1) {
+      if (!_stop) {
+        LOG(INFO) << "Error when accepting" << std::endl;
+      }
+      continue;
+    }
+
+    LOG(DEBUG) << "New shared memory connection" << std::endl;
+    _reap_sessions(false);
+
+    ShmSession* session = new ShmSession(this, client_sock);
+    _mutex.lock();
+    _sessions.push_back(session);
+    _mutex.unlock();
+    session->start();
+  }
+}
+
+/* Delete sessions whose client went away, or all of them
+ */
+void ShmServer::_reap_sessions(bool all) {
+  _mutex.lock();
+  auto it = _sessions.begin();
+  while (it != _sessions.end()) {
+    if (all || (*it)->done()) {
+      (*it)->shutdown();
+      delete *it;
+      it = _sessions.erase(it);
+    } else {
+      it ++;
+    }
+  }
+  _mutex.unlock();
+}
+
+void ShmSession::run() {
+  char ack = 1;
+  if (!_segment.recv_from(_sock) || ::write(_sock, &ack, 1) != 1) {
+    LOG(INFO) << "Shared memory handshake failed" << std::endl;
+    // the socket is closed once the session is reaped, hang up right away
+    ::shutdown(_sock, SHUT_RDWR);
+    _done = true;
+    return;
+  }
+  _segment.bind(ShmSegment::SERVER, _sock);
+  _segment.in().set_max_frame(_pserver->_max_frame);
+
+  std::string msg;
+  while (true) {
+    if (!_segment.in().read_frame(msg)) {
+      LOG(DEBUG) << "shared memory client closed" << std::endl;
+      break;
+    }
+
+    std::string resp = _pserver->_serve(msg, [this](const std::string& frame) {
+      if (!_segment.out().write_frame(frame)) {
+        throw ServerCloseSocketException();
+      }
+    }, [this](std::string& frame) {
+      return _segment.in().read_frame(frame);
+    });
+    if (!_segment.out().write_frame(resp)) {
+      break;
+    }
+  }
+  ::shutdown(_sock, SHUT_RDWR);
+  _done = true;
+}
+
+void ShmSession::shutdown() {
+  // hanging up the control socket wakes the thread up if it sleeps on a ring
+  ::shutdown(_sock, SHUT_RDWR);
+  if (is_active()) {
+    join();
+  }
+}
+
+ShmSession::~ShmSession() {
+  close(_sock);
+}
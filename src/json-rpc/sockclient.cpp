@@ -1,11 +1,14 @@
 #include "json-rpc/util.hpp"
 #include "json-rpc/buffer.hpp"
+#include "json-rpc/frame.hpp"
 #include "json-rpc/errors.hpp"
 
 #include "json-rpc/client/sockclient.hpp"
 
+#include <algorithm>
+
 SockClient::SockClient(std::string host, std::string port)
-    :_sock(UNINIT_SOCKET), _server_info(nullptr) {
+    :_sock(UNINIT_SOCKET), _server_info(nullptr), _family(AF_UNSPEC) {
   _host = host;
   _port = port;
   struct addrinfo hints;
@@ -20,10 +23,25 @@ SockClient::SockClient(std::string host, std::string port)
   }
 }
 
+SockClient::SockClient(UnixPath path)
+    :_sock(UNINIT_SOCKET), _server_info(nullptr), _unix_path(path.path),
+     _family(AF_UNIX) {
+  _host = "unix";
+  _port = _unix_path;
+  struct sockaddr_un addr;
+  if (!unix_addr(_unix_path, addr)) {
+    throw HostFailException("Unix socket path too long", _host, _port);
+  }
+}
+
 void SockClient::reconnect() {
   if (_sock != UNINIT_SOCKET) {
     close(_sock);
   }
+  if (!_unix_path.empty()) {
+    _connect_unix();
+    return;
+  }
   struct addrinfo * ptr = nullptr;
   _sock = UNINIT_SOCKET;
   for(ptr = _server_info; ptr != nullptr; ptr = ptr->ai_next) {
@@ -31,6 +49,8 @@ void SockClient::reconnect() {
     if (_sock == UNINIT_SOCKET) {
       continue;
     }
+    _family = ptr->ai_family;
+    _options.apply_connection(_sock, _family, true);
     if (connect(_sock, ptr->ai_addr, (int)ptr->ai_addrlen) == 0) {
       LOG(DEBUG) << "connect to server" << std::endl;
       break;
@@ -44,6 +64,24 @@ void SockClient::reconnect() {
   }
 }
 
+void SockClient::_connect_unix() {
+  struct sockaddr_un addr;
+  unix_addr(_unix_path, addr);
+
+  _sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_sock == UNINIT_SOCKET) {
+    throw SocketFailException("socket");
+  }
+  _options.apply_connection(_sock, AF_UNIX, true);
+  if (connect(_sock, (struct sockaddr*)&addr, sizeof(struct sockaddr_un)) != 0) {
+    LOG(DEBUG) << "Can't connect to server" << std::endl;
+    close(_sock);
+    _sock = UNINIT_SOCKET;
+    throw HostFailException("Can't connect", _host, _port);
+  }
+  LOG(DEBUG) << "connect to server" << std::endl;
+}
+
 void SockClient::send_and_response(std::string message, std::string &result) {
   if (_sock == UNINIT_SOCKET) {
     reconnect();
@@ -56,23 +94,37 @@ void SockClient::send_and_response(std::string message, std::string &result) {
   return;
 }
 
-void SockClient::_send(const std::string& msg) {
-  const int MAX_CHUNK_SIZE = 1024;
-  char chunk[MAX_CHUNK_SIZE];
+void SockClient::send_and_stream(std::string message, std::function<bool(std::string&)> on_frame) {
+  if (_sock == UNINIT_SOCKET) {
+    reconnect();
+  }
 
-  SizedRDONBuffer rd_buffer(msg.c_str(), msg.size());
-  LOG(DEBUG) << "Send out message with " << msg.size() << " bytes" << std::endl;
+  _send(message);
+  std::string frame;
+  do {
+    _recv(frame);
+  } while (on_frame(frame));
+}
 
-  while( true ) {
-    int len = rd_buffer.read(chunk, MAX_CHUNK_SIZE);
-    if (len != 0) {
-      if (write(_sock, chunk, len) != len) {
-        LOG(INFO) << "write function error" << std::endl;
-        throw WriteFailException();
-      }
-    } else {
-      break;
-    }
+void SockClient::stream_and_response(std::string message, std::function<bool(std::string&)> next_frame,
+                                     std::string& result) {
+  if (_sock == UNINIT_SOCKET) {
+    reconnect();
+  }
+
+  _send(message);
+  std::string frame;
+  while (next_frame(frame)) {
+    _send(frame);
+  }
+  _recv(result);
+}
+
+void SockClient::_send(const std::string& msg) {
+  LOG(DEBUG) << "Send out message with " << msg.size() << " bytes" << std::endl;
+  if (!send_frame(_sock, msg.data(), msg.size())) {
+    LOG(INFO) << "write function error" << std::endl;
+    throw WriteFailException();
   }
 }
 
@@ -94,8 +146,10 @@ void SockClient::_recv(std::string& result) {
   WRONBuffer wr_buffer;
 
   while( true ) {
-    int chunk_len = read(_sock, chunk, MAX_CHUNK_SIZE);
-    if (chunk_len < 0) {
+    // never read past this message, the next frame may follow right away
+    int chunk_len = read(_sock, chunk, std::min(MAX_CHUNK_SIZE, size - curr_size));
+    _options.rearm(_sock, _family);
+    if (chunk_len <= 0) {
       LOG(INFO) <<  "read function error " << chunk_len << std::endl;
       throw ReadFailException();
     }
@@ -104,14 +158,16 @@ void SockClient::_recv(std::string& result) {
 
     curr_size += chunk_len;
     if(curr_size == size)  {
-      result.assign(wr_buffer.c_str());
+      result.assign(wr_buffer.c_str(), wr_buffer.size());
       break;
     }
   }
 }
 
 SockClient::~SockClient() {
-  freeaddrinfo(_server_info);
+  if (_server_info) {
+    freeaddrinfo(_server_info);
+  }
   if (_sock != UNINIT_SOCKET) {
     close(_sock);
   }
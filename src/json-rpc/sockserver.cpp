@@ -11,6 +11,12 @@ SockServer::SockServer(std::string port)
   _connections.clear();
 }
 
+SockServer::SockServer(UnixPath path)
+    : ServerConnector(path),
+      _pool_size(POOL_SIZE), _stop(false),  _thread(this) {
+  _connections.clear();
+}
+
 SockServer::~SockServer() {
   _close_connections(); 
   _stop = true;
@@ -50,9 +56,10 @@ int SockServer::stop() {
 
 void SockServer::loop() {
   while (!_stop) {
-    struct sockaddr_in client_info;
-    socklen_t client_len = sizeof(struct sockaddr_in);
+    struct sockaddr_storage client_info;
+    socklen_t client_len = sizeof(struct sockaddr_storage);
     int client_sock = accept(_sock, (struct sockaddr*) &client_info, &client_len);
+    _options.apply_connection(client_sock, family());
 
     LOG(DEBUG) << "New connection" << std::endl;
     if (_connections.size() >= _pool_size) {
@@ -83,12 +90,15 @@ void ConnectionThread::run() {
         throw ServerBadMessageException();
       }
       Request request = Proto::build_request(msg);
-      int rst = _pserver->_handler->on_request(&request);
-      if (rst == 0) {
-        throw ServerMethodNotFoundException();
-      }
-
-      _pconn->_send_response(request.get_response());
+      Connection* pconn = _pconn;
+      request.get_response().set_sink([pconn](const std::string& frame) {
+        pconn->_send(frame);
+      });
+      request.set_source([pconn](std::string& frame) {
+        frame = pconn->_recv();
+        return frame != "";
+      });
+      _pconn->_send_response(request);
       if (!_pconn->_connected)
         throw ServerCloseSocketException();
 
@@ -115,6 +125,7 @@ std::string Connection::_recv() {
   int size = 0;
   int curr_size = 0;
   int len = read(_client_sock, (void*)&size, sizeof(int));
+  _pserver->socket_options().rearm(_client_sock, _pserver->family());
 
   if (len == 0) {
     LOG(DEBUG) << "connection closed" << std::endl;
@@ -129,7 +140,12 @@ std::string Connection::_recv() {
   LOG(DEBUG) << "The size of the message is " << size << std::endl;
 
   while(true) {
-    int chunk_len = read(_client_sock, chunk, MAX_BUFF_SIZE);
+    // never read past this message, the next frame may follow right away
+    int chunk_len = read(_client_sock, chunk, std::min(MAX_BUFF_SIZE, size - curr_size));
+    if (chunk_len <= 0) {
+      LOG(DEBUG) << "connection closed" << std::endl;
+      throw ServerCloseSocketException();
+    }
 
     wr_buffer.write(chunk, chunk_len);
     curr_size += chunk_len;
@@ -144,36 +160,33 @@ std::string Connection::_recv() {
 }
 
 
-void Connection::_send(std::string msg) {
-  const int MAX_CHUNK_SIZE = 1024;
-  char chunk[MAX_CHUNK_SIZE];
-
-  SizedRDONBuffer rd_buffer(msg.c_str(), msg.size());
+void Connection::_send(const std::string& msg) {
   LOG(DEBUG) << "Send out message with " << msg.size() << " bytes" << std::endl;
-
-  while( true ) {
-    int len = rd_buffer.read(chunk, MAX_CHUNK_SIZE);
-    if (len != 0) {
-      int real_len = write(_client_sock, chunk, len);
-      if (real_len == 0) {
-        throw ServerCloseSocketException();
-      }
-
-      if (real_len != len) {
-        LOG(FATAL) << "write function error" << std::endl;
-      }
-    } else {
-      break;
-    }
+  if (!send_frame(_client_sock, msg.data(), msg.size())) {
+    throw ServerCloseSocketException();
   }
 }
 
-void Connection::_send_response(Response& resp) {
-  std::string jsonText = Proto::build_response(resp);
-  _send(jsonText); 
+void Connection::_send_response(Request& request) {
+  FrameBuffer* frame = FramePool::get_instance().acquire();
+  try {
+    _pserver->_respond_wait(request, *frame);
+  } catch(...) {
+    FramePool::get_instance().release(frame);
+    throw;
+  }
+  LOG(DEBUG) << "Send out message with " << frame->payload_size() << " bytes" << std::endl;
+  bool sent = send_frame(_client_sock, *frame);
+  FramePool::get_instance().release(frame);
+  if (!sent) {
+    throw ServerCloseSocketException();
+  }
 }
 
 void Connection::_send_error(int code) {
   std::string jsonText = Proto::build_error(code);
-  _send(jsonText); 
+  // best effort, the connection is being given up on anyway
+  if (!send_frame(_client_sock, jsonText.data(), jsonText.size())) {
+    LOG(DEBUG) << "Failed to send error " << code << std::endl;
+  }
 }
@@ -0,0 +1,120 @@
+#include "json-rpc/timerwheel.hpp"
+
+TimerWheel::TimerWheel(uint64_t now_ms) : _current(now_ms), _next_id(0) {
+}
+
+TimerWheel::~TimerWheel() {
+  for(auto it = _timers.begin(); it != _timers.end(); it ++) {
+    delete it->second;
+  }
+}
+
+TimerWheel::TimerId TimerWheel::schedule(long delay_ms, std::function<void()> fn) {
+  Timer* timer = new Timer();
+  timer->id = ++ _next_id;
+  timer->expires = _current + (delay_ms > 0 ? delay_ms : 0);
+  timer->fn = fn;
+  _timers[timer->id] = timer;
+  _place(timer);
+  return timer->id;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+  auto it = _timers.find(id);
+  if (it == _timers.end()) {
+    return false;
+  }
+  _unlink(it->second);
+  delete it->second;
+  _timers.erase(it);
+  return true;
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+  while (_current <= now_ms) {
+    if (_timers.empty()) {
+      // nothing to move or run on the way
+      _current = now_ms + 1;
+      return;
+    }
+
+    // every 64 ticks a slot of level 1 moves down, every 4096 one of level 2
+    for(int level = 1; level < LEVELS; level ++) {
+      if ((_current & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) {
+        break;
+      }
+      _cascade(level);
+    }
+
+    Slot& slot = _slots[0][_current & (SLOTS - 1)];
+    _current ++;
+    while (!slot.empty()) {
+      // fn may schedule or cancel timers, this one is gone by then
+      Timer* timer = slot.head.next;
+      _unlink(timer);
+      _timers.erase(timer->id);
+      std::function<void()> fn = std::move(timer->fn);
+      delete timer;
+      fn();
+    }
+  }
+}
+
+long TimerWheel::next_timeout(uint64_t now_ms) const {
+  if (_timers.empty()) {
+    return -1;
+  }
+  uint64_t ticks = 0;
+  for(; ticks < SLOTS; ticks ++) {
+    uint64_t tick = _current + ticks;
+    if ((tick & (SLOTS - 1)) == 0) {
+      // the level above moves down here
+      break;
+    }
+    if (!_slots[0][tick & (SLOTS - 1)].empty()) {
+      break;
+    }
+  }
+  uint64_t due = _current + ticks;
+  return due > now_ms ? (long)(due - now_ms) : 0;
+}
+
+/* Put timer in the slot its expiry falls in, seen from _current */
+void TimerWheel::_place(Timer* timer) {
+  if (timer->expires < _current) {
+    timer->expires = _current;
+  }
+  uint64_t delta = timer->expires - _current;
+
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+    level ++;
+  }
+  uint64_t tick = timer->expires;
+  if (delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+    // beyond the wheel, wait in the farthest slot and be placed again
+    tick = _current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+  }
+
+  Slot& slot = _slots[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)];
+  timer->prev = slot.head.prev;
+  timer->next = &slot.head;
+  slot.head.prev->next = timer;
+  slot.head.prev = timer;
+}
+
+/* Move the timers of the current slot of level to the levels below */
+void TimerWheel::_cascade(int level) {
+  Slot& slot = _slots[level][(_current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+  while (!slot.empty()) {
+    Timer* timer = slot.head.next;
+    _unlink(timer);
+    _place(timer);
+  }
+}
+
+void TimerWheel::_unlink(Timer* timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = timer->next = timer;
+}
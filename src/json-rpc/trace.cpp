@@ -0,0 +1,127 @@
+#include "json-rpc/trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+void TraceRing::push(const char* name, uint64_t start, uint64_t end, uint64_t id) {
+  uint64_t head = _head.load(std::memory_order_relaxed);
+  Slot& slot = _slots[head % CAPACITY];
+
+  // mark the slot as being written, readers will skip it
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.span.name = name;
+  slot.span.start = start;
+  slot.span.dur = end - start;
+  slot.span.id = id;
+
+  slot.seq.store(head + 1, std::memory_order_release);
+  _head.store(head + 1, std::memory_order_release);
+}
+
+void TraceRing::snapshot(std::vector<TraceSpan>& spans) const {
+  uint64_t head = _head.load(std::memory_order_acquire);
+  uint64_t first = head > CAPACITY ? head - CAPACITY : 0;
+
+  for(uint64_t i = first; i < head; i ++) {
+    const Slot& slot = _slots[i % CAPACITY];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != i + 1) continue;
+
+    TraceSpan span = slot.span;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+    spans.push_back(span);
+  }
+}
+
+Tracer Tracer::_instance;
+
+Tracer::Tracer() : _period(0), _next_id(1) {
+}
+
+void Tracer::set_sample_rate(double rate) {
+  uint32_t period = 0;
+  if (rate >= 1.0) {
+    period = 1;
+  } else if (rate > 0.0) {
+    period = (uint32_t)(1.0 / rate + 0.5);
+  }
+  _period.store(period, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::start_trace() {
+  uint32_t period = _period.load(std::memory_order_relaxed);
+  if (period == 0) return 0;
+
+  // per thread counter, so sampling never touches shared cache lines
+  static thread_local uint32_t counter = 0;
+  if (++ counter < period) return 0;
+  counter = 0;
+
+  return _next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceRing* Tracer::_local_ring() {
+  static thread_local TraceRing* ring = nullptr;
+  if (ring == nullptr) {
+    ScopeLock _(&_mutex);
+    // rings outlive their threads so a dump still sees their spans
+    ring = new TraceRing(_rings.size() + 1);
+    _rings.push_back(ring);
+  }
+  return ring;
+}
+
+std::string Tracer::dump() {
+  std::vector<TraceRing*> rings;
+  {
+    ScopeLock _(&_mutex);
+    rings = _rings;
+  }
+
+  int pid = getpid();
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+
+  std::vector<TraceSpan> spans;
+  for(size_t r = 0; r < rings.size(); r ++) {
+    spans.clear();
+    rings[r]->snapshot(spans);
+
+    for(size_t i = 0; i < spans.size(); i ++) {
+      if (!first) out += ",";
+      first = false;
+      // chrome trace timestamps are in microseconds
+      char event[256];
+      snprintf(event, sizeof event,
+          "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+          "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+          spans[i].name, pid, rings[r]->tid(),
+          spans[i].start / 1000.0, spans[i].dur / 1000.0,
+          (unsigned long long)spans[i].id);
+      out += event;
+    }
+  }
+  out += "]}";
+  return out;
+}
+
+bool Tracer::dump(const std::string& filename) {
+  std::ofstream fout(filename.c_str());
+  if (!fout) {
+    LOG(INFO) << "Can't open trace file " << filename << std::endl;
+    return false;
+  }
+  fout << dump();
+  return fout.good();
+}
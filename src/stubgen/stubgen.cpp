@@ -49,17 +49,24 @@ int main(int argc, char** argv) {
   }
 
   std::string service_name = spacename->getString();
+  SpecOptions options = SpecOptions::from_json(spec);
 
   std::vector<ClassDef> classdefs;
   classdefs.clear();
   if (classes) {
     std::vector<std::string> classnames = classes->getKeys();
+    // fixed layout classes are known before any type refers to them
     for(int i = 0; i < classnames.size(); i ++ ) {
-      classdefs.push_back(ClassDef::from_json(classnames[i], classes->get(classnames[i]) ) );
+      if (ClassDef::is_pod_spec(classes->get(classnames[i]))) {
+        options.pod_classes.insert(classnames[i]);
+      }
+    }
+    for(int i = 0; i < classnames.size(); i ++ ) {
+      classdefs.push_back(ClassDef::from_json(classnames[i], classes->get(classnames[i]), options) );
     }
   }
   
-  ServiceDef servicedef = ServiceDef::from_json(service_name, service);
+  ServiceDef servicedef = ServiceDef::from_json(service_name, service, options);
 
   CppWriter writer(service_name, classdefs, servicedef);
   writer.write();